@@ -0,0 +1,405 @@
+// Benchmarks for the paths a frame loop depends on, timed through wtk_stats so they measure what wtk itself reports.
+// Meant to run under Xvfb, or headless Weston for the Wayland build, with Mesa's llvmpipe (see the Makefile) so
+// results don't depend on the GPU or compositor
+//
+// Usage: wtk_bench [--csv] [bench...]    Benches: events create swap scale dispatch blit present, all of them by default
+//
+// Prints one result per row, as a JSON array or CSV: backend, bench, n, metric, value, unit
+
+#define WTK_IMPL
+#include "../wtk.h"
+#include <GL/gl.h>
+
+#if defined(WTK_API_HEADLESS)
+    #define BENCH_BACKEND "headless"
+#elif defined(WTK_API_WAYLAND)
+    #define BENCH_BACKEND "wayland"
+#elif defined(WTK_X11_EGL)
+    #define BENCH_BACKEND "x11-egl"
+#elif defined(WTK_API_X11)
+    #define BENCH_BACKEND "x11-glx"
+#else
+    #define BENCH_BACKEND "unknown"
+#endif
+
+#define BENCH_MAX_RESULTS 256
+#define BENCH_TIMEOUT_NS 10000000000ull
+#define BENCH_MAX_WINDOWS 1000
+
+typedef struct bench_result_t {
+    char const *bench;
+    int n;
+    char const *metric;
+    double value;
+    char const *unit;
+} bench_result_t;
+
+static bench_result_t bench_results[BENCH_MAX_RESULTS];
+static int bench_result_count;
+static uint64_t bench_received;
+static int bench_failed;
+
+static void bench_report(char const *bench, int n, char const *metric, double value, char const *unit) {
+    if (bench_result_count < BENCH_MAX_RESULTS)
+        bench_results[bench_result_count++] = (bench_result_t){bench, n, metric, value, unit};
+}
+
+static void bench_callback(wtk_window_t *window, wtk_event_t const *event) {
+    (void)window;
+    if (event->type == WTK_EVENTTYPE_MOUSEMOTION || event->type == WTK_EVENTTYPE_WINDOWEXPOSE)
+        bench_received++;
+}
+
+static wtk_stats_t bench_stats_delta(wtk_stats_t const *before) {
+    wtk_stats_t now;
+    wtk_stats(&now);
+    return (wtk_stats_t){
+        .polls           = now.polls - before->polls,
+        .poll_ns         = now.poll_ns - before->poll_ns,
+        .events          = now.events - before->events,
+        .dropped         = now.dropped - before->dropped,
+        .windows_created = now.windows_created - before->windows_created,
+        .create_ns       = now.create_ns - before->create_ns,
+        .windows_deleted = now.windows_deleted - before->windows_deleted,
+        .delete_ns       = now.delete_ns - before->delete_ns,
+        .swaps           = now.swaps - before->swaps,
+        .swap_ns         = now.swap_ns - before->swap_ns,
+    };
+}
+
+static double bench_per(uint64_t total, uint64_t count) {
+    return count ? (double)total / (double)count : 0.0;
+}
+
+// Polls until the window system has handed over whatever it was sent, so the first timed poll starts from empty
+static void bench_settle(void) {
+    for (int i = 0; i < 10; i++)
+        wtk_poll_events();
+}
+
+// Gets count synthetic events into the queues wtk_poll_events reads. X11 sends pointer motion to the window itself;
+// headless has no input at all and Wayland clients can't fake any, so one expose per requested redraw stands in
+static void bench_inject(wtk_window_t *window, int count) {
+#if defined(WTK_API_X11)
+    wtk_native_t native = wtk_window_native(window);
+    Display *display = native.display;
+    for (int i = 0; i < count; i++) {
+        XEvent event = {.xmotion = {
+            .type = MotionNotify, .display = display, .window = (Window)native.window,
+            .x = i % 100, .y = i / 100 % 100, .same_screen = True,
+        }};
+        XSendEvent(display, (Window)native.window, False, PointerMotionMask, &event);
+    }
+    XFlush(display);
+#else
+    (void)count;
+    wtk_window_request_redraw(window, NULL);
+#endif
+}
+
+// Throughput of wtk_poll_events from the synthetic events sent until the last is delivered, and the poll time each
+// event costs as wtk_stats counts it
+static void bench_events(void) {
+    wtk_window_t *window = wtk_window_create(&(wtk_window_desc_t){.title = "bench", .callback = bench_callback, .context = WTK_CONTEXT_NONE});
+    if (!window) return;
+    bench_settle();
+
+#if defined(WTK_API_X11)
+    int const batches = 10, batch = 1000;
+#else
+    int const batches = 10000, batch = 1;
+#endif
+    bench_received = 0;
+
+    wtk_stats_t before;
+    wtk_stats(&before);
+    uint64_t start = wtk_time_ns();
+    for (int i = 0; i < batches && wtk_time_ns() - start < BENCH_TIMEOUT_NS; i++) {
+        bench_inject(window, batch);
+        uint64_t want = (uint64_t)(i + 1) * batch;
+        while (bench_received < want && wtk_time_ns() - start < BENCH_TIMEOUT_NS)
+            wtk_poll_events();
+    }
+    uint64_t elapsed = wtk_time_ns() - start;
+    wtk_stats_t delta = bench_stats_delta(&before);
+
+    bench_report("events", batches * batch, "received", (double)bench_received, "events");
+    bench_report("events", batches * batch, "throughput", bench_per(bench_received * 1000000000ull, elapsed), "events/s");
+    bench_report("events", batches * batch, "poll_per_event", bench_per(delta.poll_ns, delta.events), "ns");
+    bench_report("events", batches * batch, "poll", bench_per(delta.poll_ns, delta.polls), "ns");
+
+    wtk_window_delete(window);
+}
+
+// Create and delete latency as wtk_stats measures it, with and without a GL context
+static void bench_create(void) {
+    int const count = 32;
+    struct { char const *name; int context; } modes[] = {
+        {"create_gl", WTK_CONTEXT_EAGER},
+        {"create_nogl", WTK_CONTEXT_NONE},
+    };
+
+    for (size_t m = 0; m < sizeof modes / sizeof *modes; m++) {
+        wtk_stats_t before;
+        wtk_stats(&before);
+        for (int i = 0; i < count; i++) {
+            wtk_window_t *window = wtk_window_create(&(wtk_window_desc_t){.title = "bench", .callback = bench_callback, .context = modes[m].context});
+            if (!window) break;
+            wtk_poll_events();
+            wtk_window_delete(window);
+        }
+        wtk_stats_t delta = bench_stats_delta(&before);
+
+        bench_report(modes[m].name, count, "create", bench_per(delta.create_ns, delta.windows_created), "ns");
+        bench_report(modes[m].name, count, "delete", bench_per(delta.delete_ns, delta.windows_deleted), "ns");
+    }
+}
+
+// CPU cost of wtk_window_swap_buffers with vsync off, so it's the driver and wtk overhead and not the wait for vblank
+static void bench_swap(void) {
+    int const frames = 500;
+    wtk_window_t *window = wtk_window_create(&(wtk_window_desc_t){.title = "bench", .callback = bench_callback, .w = 256, .h = 256});
+    if (!window) return;
+
+    wtk_window_make_current(window);
+    wtk_window_set_swap_interval(window, 0);
+    bench_settle();
+
+    wtk_stats_t before;
+    wtk_stats(&before);
+    for (int i = 0; i < frames; i++) {
+        glClearColor((float)(i & 1), 0.0f, 0.0f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+        wtk_window_swap_buffers(window);
+        wtk_poll_events();
+    }
+    wtk_stats_t delta = bench_stats_delta(&before);
+
+    wtk_frame_stats_t stats = {0};
+    wtk_window_frame_stats(window, &stats);
+
+    bench_report("swap", frames, "swap", bench_per(delta.swap_ns, delta.swaps), "ns");
+    bench_report("swap", frames, "swap_p50", (double)stats.swap_p50_ns, "ns");
+    bench_report("swap", frames, "swap_p99", (double)stats.swap_p99_ns, "ns");
+
+    wtk_window_delete(window);
+}
+
+// Cost of an idle wtk_poll_events and of creating a window as more of them are open
+static void bench_scale(void) {
+    static int const counts[] = {1, 10, 100};
+    static wtk_window_t *windows[BENCH_MAX_WINDOWS];
+    int const polls = 200;
+
+    for (size_t c = 0; c < sizeof counts / sizeof *counts; c++) {
+        int n = 0;
+        wtk_stats_t before;
+        wtk_stats(&before);
+        while (n < counts[c] && (windows[n] = wtk_window_create(&(wtk_window_desc_t){.title = "bench", .callback = bench_callback, .w = 64, .h = 64, .context = WTK_CONTEXT_NONE})))
+            n++;
+        wtk_stats_t created = bench_stats_delta(&before);
+        bench_settle();
+
+        wtk_stats(&before);
+        for (int i = 0; i < polls; i++)
+            wtk_poll_events();
+        wtk_stats_t delta = bench_stats_delta(&before);
+
+        bench_report("scale", n, "create", bench_per(created.create_ns, created.windows_created), "ns");
+        bench_report("scale", n, "idle_poll", bench_per(delta.poll_ns, delta.polls), "ns");
+
+        while (n)
+            wtk_window_delete(windows[--n]);
+    }
+}
+
+// Per-event cost of getting events to their window as more windows are open. Events go round-robin, so each one
+// looks up a different window than the last
+static void bench_dispatch(void) {
+    static int const counts[] = {1, 10, 100, 1000};
+    static wtk_window_t *windows[BENCH_MAX_WINDOWS];
+    int const total = 10000;
+
+    for (size_t c = 0; c < sizeof counts / sizeof *counts; c++) {
+        int n = 0;
+        while (n < counts[c] && (windows[n] = wtk_window_create(&(wtk_window_desc_t){.title = "bench", .callback = bench_callback, .w = 64, .h = 64, .context = WTK_CONTEXT_NONE})))
+            n++;
+        bench_settle();
+
+        // One event per window and round, headless couldn't do more since its exposes merge within a poll
+        int rounds = n ? (total + n - 1) / n : 0;
+        bench_received = 0;
+
+        wtk_stats_t before;
+        wtk_stats(&before);
+        uint64_t start = wtk_time_ns();
+        for (int r = 0; r < rounds && wtk_time_ns() - start < BENCH_TIMEOUT_NS; r++) {
+            for (int i = 0; i < n; i++)
+                bench_inject(windows[i], 1);
+            uint64_t want = (uint64_t)(r + 1) * n;
+            while (bench_received < want && wtk_time_ns() - start < BENCH_TIMEOUT_NS)
+                wtk_poll_events();
+        }
+        wtk_stats_t delta = bench_stats_delta(&before);
+
+        bench_report("dispatch", n, "received", (double)bench_received, "events");
+        bench_report("dispatch", n, "poll_per_event", bench_per(delta.poll_ns, delta.events), "ns");
+
+        while (n)
+            wtk_window_delete(windows[--n]);
+    }
+}
+
+// wtk_window_blit throughput for each source format, 1:1 and 2x upscaled (n is the scale), as bytes written to the
+// window per second
+static void bench_blit(void) {
+    int const w = 1920, h = 1080, iterations = 50;
+    static char const *const names[WTK_PIXELFORMAT_COUNT] = {"blit_bgrx8", "blit_rgba8", "blit_rgba32f"};
+
+    wtk_window_t *window = wtk_window_create(&(wtk_window_desc_t){.title = "bench", .callback = bench_callback, .w = w, .h = h, .context = WTK_CONTEXT_NONE});
+    if (!window) return;
+
+    int dst_stride;
+    float *src = malloc((size_t)w * h * 16);
+    if (!src || !wtk_window_map_pixels(window, &dst_stride)) {
+        free(src);
+        wtk_window_delete(window);
+        return;
+    }
+    for (size_t i = 0; i < (size_t)w * h * 4; i++)
+        src[i] = (float)(i % 251) / 250.0f;
+
+    for (int format = 0; format < WTK_PIXELFORMAT_COUNT; format++) {
+        int bpp = format == WTK_PIXELFORMAT_RGBA32F ? 16 : 4;
+        for (int scale = 1; scale <= 2; scale++) {
+            wtk_rect_t rect = {0, 0, w / scale, h / scale};
+
+            // Once untimed so page faults and kernel selection stay out of it
+            wtk_window_blit(window, src, format, w * bpp, &rect, scale);
+
+            uint64_t bytes = 0, start = wtk_time_ns();
+            for (int i = 0; i < iterations; i++) {
+                wtk_rect_t written = wtk_window_blit(window, src, format, w * bpp, &rect, scale);
+                bytes += (uint64_t)written.w * written.h * 4;
+            }
+            uint64_t elapsed = wtk_time_ns() - start;
+
+            bench_report(names[format], scale, "throughput", bench_per(bytes, elapsed), "GB/s");
+        }
+    }
+
+    free(src);
+    wtk_window_delete(window);
+}
+
+// What the window shows at x, y as 0xRRGGBB, read back from the server on X11 and from the buffer elsewhere. Wayland
+// can't read the compositor's copy, but presenting carries the rects over to the buffer mapped next
+static uint32_t bench_read_pixel(wtk_window_t *window, int x, int y) {
+#if defined(WTK_API_X11)
+    wtk_native_t native = wtk_window_native(window);
+    XSync(native.display, False);
+    XImage *image = XGetImage(native.display, (Window)native.window, x, y, 1, 1, AllPlanes, ZPixmap);
+    if (!image)
+        return 0;
+    uint32_t pixel = (uint32_t)XGetPixel(image, 0, 0) & 0xffffff;
+    XDestroyImage(image);
+    return pixel;
+#else
+    int stride;
+    uint32_t const *pixels = wtk_window_map_pixels(window, &stride);
+    return pixels ? pixels[(size_t)y * (stride / 4) + x] & 0xffffff : 0;
+#endif
+}
+
+// Not a timing but a check the numbers depend on: blit, present, blit, present has to show the second blit, with
+// double-buffered MIT-SHM flipping segments in between. ok is 1 when it does, and the run fails otherwise
+static void bench_present(void) {
+    enum { w = 64, h = 64 };
+    static uint32_t src[2][w * h];
+    uint32_t const colors[2] = {0xff0000, 0x00ff00}; // Expected 0xRRGGBB, the sources are the same in RGBA8
+
+    wtk_window_t *window = wtk_window_create(&(wtk_window_desc_t){.title = "bench", .callback = bench_callback, .w = w, .h = h, .context = WTK_CONTEXT_NONE});
+    if (!window) return;
+    bench_settle();
+
+    for (int f = 0; f < 2; f++) {
+        unsigned char const rgba[4] = {colors[f] >> 16, colors[f] >> 8 & 0xff, colors[f] & 0xff, 0xff};
+        for (int i = 0; i < w * h; i++)
+            memcpy(&src[f][i], rgba, 4);
+
+        wtk_rect_t written = wtk_window_blit(window, src[f], WTK_PIXELFORMAT_RGBA8, w * 4, &(wtk_rect_t){0, 0, w, h}, 1);
+        wtk_window_present_pixels(window, &written, 1);
+    }
+
+    int ok = 1;
+    for (int y = 0; y < h; y += h / 4)
+        for (int x = 0; x < w; x += w / 4)
+            ok &= bench_read_pixel(window, x, y) == colors[1];
+    bench_failed |= !ok;
+    bench_report("present", 2, "ok", ok, "bool");
+
+    wtk_window_delete(window);
+}
+
+static struct {
+    char const *name;
+    void (*run)(void);
+} const bench_list[] = {
+    {"events", bench_events},
+    {"create", bench_create},
+    {"swap",   bench_swap},
+    {"scale",  bench_scale},
+    {"dispatch", bench_dispatch},
+    {"blit",   bench_blit},
+    {"present", bench_present},
+};
+
+static void bench_print(int csv) {
+    if (csv) {
+        printf("backend,bench,n,metric,value,unit\n");
+        for (int i = 0; i < bench_result_count; i++) {
+            bench_result_t const *r = &bench_results[i];
+            printf("%s,%s,%d,%s,%.6g,%s\n", BENCH_BACKEND, r->bench, r->n, r->metric, r->value, r->unit);
+        }
+        return;
+    }
+
+    printf("[\n");
+    for (int i = 0; i < bench_result_count; i++) {
+        bench_result_t const *r = &bench_results[i];
+        printf("  {\"backend\": \"%s\", \"bench\": \"%s\", \"n\": %d, \"metric\": \"%s\", \"value\": %.6g, \"unit\": \"%s\"}%s\n",
+            BENCH_BACKEND, r->bench, r->n, r->metric, r->value, r->unit, i + 1 < bench_result_count ? "," : "");
+    }
+    printf("]\n");
+}
+
+int main(int argc, char **argv) {
+    int csv = 0, selected = 0;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--csv")) {
+            csv = 1;
+            continue;
+        }
+
+        size_t b = 0;
+        while (b < sizeof bench_list / sizeof *bench_list && strcmp(argv[i], bench_list[b].name))
+            b++;
+        if (b == sizeof bench_list / sizeof *bench_list) {
+            fprintf(stderr, "unknown bench: %s\n", argv[i]);
+            return 2;
+        }
+        selected = 1;
+    }
+
+    for (size_t b = 0; b < sizeof bench_list / sizeof *bench_list; b++) {
+        int run = !selected;
+        for (int i = 1; i < argc && !run; i++)
+            run = !strcmp(argv[i], bench_list[b].name);
+        if (run)
+            bench_list[b].run();
+    }
+
+    bench_print(csv);
+    wtk_shutdown();
+    return bench_result_count && !bench_failed ? 0 : 1;
+}
@@ -6,6 +6,18 @@
 
 #pragma once
 
+// The implementation needs POSIX.1-2008 (clock_gettime, nanosleep), which -std=c11 hides. Asking for it alone would
+// take glibc's default extensions away from the rest of the file, so those are asked for too. Both have to come
+// before the first system header
+#if defined(__linux__) && !defined(_DEFAULT_SOURCE)
+    #define _DEFAULT_SOURCE
+#endif
+#if defined(__linux__) && !defined(_POSIX_C_SOURCE)
+    #define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <stdint.h>
+
 ///////////////////////////////////////////////////////////////////////////////
 /// Constants
 
@@ -22,6 +34,9 @@ enum {
     WTK_EVENTTYPE_WINDOWRESIZE,
     WTK_EVENTTYPE_WINDOWFOCUSIN,
     WTK_EVENTTYPE_WINDOWFOCUSOUT,
+    WTK_EVENTTYPE_WINDOWMOVE,
+    WTK_EVENTTYPE_WINDOWEXPOSE,
+    WTK_EVENTTYPE_MONITORCHANGE, // Sent to every window when monitors are added, removed or change mode
 };
 
 // Ascii keys can use their character representation, e.g. 'w', 'A', '+', ...
@@ -35,6 +50,7 @@ enum {
     WTK_KEY_CAPSLOCK,
 };
 
+// Left, right, middle, back, forward, then whatever else the mouse has
 enum {
     WTK_BUTTON_1,
     WTK_BUTTON_2,
@@ -46,6 +62,11 @@ enum {
     WTK_BUTTON_8,
 };
 
+enum {
+    WTK_GL_PROFILE_CORE,
+    WTK_GL_PROFILE_COMPAT,
+};
+
 enum {
     WTK_MOD_SHIFT    = 0x01,
     WTK_MOD_CTRL     = 0x02,
@@ -54,42 +75,180 @@ enum {
     WTK_MOD_CAPSLOCK = 0x10,
 };
 
+// When a window's GL context is created
+enum {
+    WTK_CONTEXT_EAGER,  // With the window
+    WTK_CONTEXT_LAZY,   // By the first call that needs it, usually wtk_window_make_current
+    WTK_CONTEXT_NONE,   // Never, for Vulkan through wtk_window_native or the pixel functions
+};
+
+// Source layouts for wtk_window_blit. Windows are opaque, so alpha is dropped: premultiplied input shows as if over black
+enum {
+    WTK_PIXELFORMAT_BGRX8,      // The mapped buffer's own layout, copied as is
+    WTK_PIXELFORMAT_RGBA8,
+    WTK_PIXELFORMAT_RGBA32F,    // Clamped to [0, 1]
+    WTK_PIXELFORMAT_COUNT,
+};
+
 ///////////////////////////////////////////////////////////////////////////////
 /// Types
 
 typedef struct wtk_window_t wtk_window_t;
+typedef struct wtk_context_t wtk_context_t;
+
+typedef struct wtk_rect_t {
+    int x, y, w, h;
+} wtk_rect_t;
 
 typedef struct wtk_event_t {
     int type;
     int key, button, mods;
     struct { int x, y; } location, delta;
+    int merged; // Number of native events coalesced into this one
+    int repeat; // KEYDOWN sent by auto-repeat while the key was already held, where the platform reports that
+    uint64_t time_ns; // On the wtk_time_ns clock, from the native timestamp where the backend has a usable one
+    wtk_rect_t rect;  // WINDOWEXPOSE: the area to repaint, the bounds of everything damaged since the last one
 } wtk_event_t;
 
+typedef struct wtk_frame_t {
+    uint64_t start_ns;      // When wtk_window_swap_buffers was entered
+    uint64_t swap_ns;       // CPU time spent blocked in the swap
+    uint64_t interval_ns;   // Time since the previous swap returned
+    uint64_t present_ns;    // Best effort: when this frame's swap completed on screen, once the driver reports it; 0 before
+                            // then or if unsupported (only GLX with GLX_INTEL_swap_event reports it)
+    uint32_t missed;        // Vblanks missed between the previous frame's present and this one's. From the driver along
+                            // with present_ns, elsewhere estimated from interval_ns against the swap interval times the
+                            // monitor's refresh period, and 0 when either is unknown
+} wtk_frame_t;
+
+typedef struct wtk_frame_stats_t {
+    int frames;             // Number of recent frames summarized
+    uint64_t swap_p50_ns, swap_p99_ns, swap_max_ns;
+    uint64_t interval_p50_ns, interval_p99_ns, interval_max_ns; // Over frames that had a previous one
+    uint64_t missed;        // Total missed vblanks since the window was created
+    uint64_t first_frame_ns; // Time from wtk_window_create until its first swap returned, 0 before then
+    wtk_frame_t last;
+} wtk_frame_stats_t;
+
+typedef struct wtk_monitor_t {
+    uintptr_t id;       // RandR CRTC, HMONITOR, CGDirectDisplayID or wl_output, stable while the monitor is connected
+    char name[64];      // Output or device name, e.g. "DP-1"
+    int x, y, w, h;     // On the desktop, in the units window positions and sizes use
+    int mm_w, mm_h;     // Physical size, 0 if unknown
+    int refresh_mhz;    // Refresh rate in millihertz from the mode timings, e.g. 59940; 0 if unknown
+    uint64_t period_ns; // The matching frame period, ready for wtk_run_desc_t.frame_ns
+    float scale;        // Backing pixels per unit on Cocoa/Wayland, DPI / 96 on Win32/X11
+    int primary;
+} wtk_monitor_t;
+
+// Process-wide counters, cumulative and never reset, so a harness can diff two snapshots
+typedef struct wtk_stats_t {
+    uint64_t polls;             // wtk_poll_events calls
+    uint64_t poll_ns;           // Time spent in them, blocking waits are not counted
+    uint64_t events;            // Events delivered to callbacks or queues
+    uint64_t dropped;           // Queued events overwritten because a queue was full
+    uint64_t windows_created, create_ns;
+    uint64_t windows_deleted, delete_ns;
+    uint64_t swaps, swap_ns;
+} wtk_stats_t;
+
+// Anything the driver can't provide is dropped in order: no_error, debug, samples, srgb, then the version steps down
+typedef struct wtk_gl_desc_t {
+    int major, minor;               // 0 picks the backend default
+    int profile;                    // WTK_GL_PROFILE_*, only meaningful for 3.2+
+    int debug;
+    int no_error;                   // GL_KHR_no_error context, ignored when debug is set
+    int samples;                    // MSAA samples, 0 for none
+    int srgb;                       // sRGB-capable default framebuffer
+    int depth_bits, stencil_bits;   // 0 picks 24/8, negative requests none
+} wtk_gl_desc_t;
+
 typedef struct wtk_window_desc_t {
     void (*callback)(wtk_window_t *window, wtk_event_t const *event);
     char const *title;
     int w, h;
+    int queue_size; // If > 0, events are queued for wtk_window_next_events() instead of sent to callback
+    int coalesce;   // Merge consecutive mouse motion and report at most one move/resize per poll
+    int context;    // WTK_CONTEXT_*
+    wtk_gl_desc_t gl;
 } wtk_window_desc_t;
 
+// What a Vulkan surface is created from; fields a backend has no use for are 0
+typedef struct wtk_native_t {
+    void *display;      // Display * on X11, wl_display * on Wayland, HINSTANCE on Win32
+    uintptr_t window;   // X11 Window, wl_surface *, HWND or NSWindow *
+    void *view;         // NSView * on Cocoa, for a CAMetalLayer
+} wtk_native_t;
+
+typedef struct wtk_tick_t {
+    uint64_t time_ns;   // When the frame started, after its events were polled
+    uint64_t dt_ns;     // Since the previous frame started, 0 on the first
+    uint64_t frame;     // Frames run so far
+    double alpha;       // Unsimulated fraction of a fixed step, for interpolating between updates; 0 without them
+} wtk_tick_t;
+
+// A zeroed desc renders as fast as the swap interval lets it
+typedef struct wtk_run_desc_t {
+    uint64_t frame_ns;  // Target frame period, 0 leaves pacing to the swap blocking on vsync
+    uint64_t step_ns;   // If > 0, update runs in fixed steps of this length to keep up with real time
+    int max_steps;      // Per frame, so a stall can't snowball; 0 picks 8
+    int late_latch;     // Start each frame as late as recent frame times allow, so input is polled close to the present
+    void (*update)(wtk_window_t *window, uint64_t step_ns, void *user);
+    void *user;
+} wtk_run_desc_t;
+
 ///////////////////////////////////////////////////////////////////////////////
 /// Functions
 
-wtk_window_t   *wtk_window_create       (wtk_window_desc_t const *desc);
-void            wtk_window_make_current (wtk_window_t *window);
-void            wtk_window_swap_buffers (wtk_window_t *window);
-void            wtk_window_delete       (wtk_window_t *window);
-
-void            wtk_poll_events         (void);
-
-void            wtk_window_pos          (wtk_window_t const *window, int *x, int *y);
-void            wtk_window_size         (wtk_window_t const *window, int *w, int *h);
-void            wtk_window_fbsize       (wtk_window_t const *window, int *w, int *h);
-int             wtk_window_closed       (wtk_window_t const *window);
-
-void            wtk_window_set_pos      (wtk_window_t *window, int x, int y);
-void            wtk_window_set_size     (wtk_window_t *window, int w, int h);
-void            wtk_window_set_title    (wtk_window_t *window, char const *title);
-void            wtk_window_set_closed   (wtk_window_t *window, int closed);
+wtk_window_t   *wtk_window_create            (wtk_window_desc_t const *desc);
+void            wtk_window_make_current      (wtk_window_t *window);
+void            wtk_window_swap_buffers      (wtk_window_t *window);
+void            wtk_window_swap_buffers_damage (wtk_window_t *window, wtk_rect_t const *rects, int n);
+void            wtk_window_delete            (wtk_window_t *window);
+int             wtk_window_next_events       (wtk_window_t *window, wtk_event_t *events, int cap);
+void           *wtk_window_map_pixels        (wtk_window_t *window, int *stride);
+void            wtk_window_present_pixels    (wtk_window_t *window, wtk_rect_t const *rects, int n);
+wtk_rect_t      wtk_window_blit              (wtk_window_t *window, void const *src, int format, int stride, wtk_rect_t const *rect, int scale);
+void            wtk_window_request_redraw    (wtk_window_t *window, wtk_rect_t const *rect);
+
+wtk_context_t  *wtk_context_create_shared    (wtk_window_t *window);
+void            wtk_context_make_current     (wtk_context_t *context);
+void            wtk_context_delete           (wtk_context_t *context);
+
+void            wtk_poll_events              (void);
+void            wtk_wait_events              (void);
+void            wtk_wait_events_timeout      (uint64_t ns);
+void            wtk_post_empty_event         (void);
+void            wtk_run                      (wtk_window_t *window, void (*frame)(wtk_window_t *window, wtk_tick_t const *tick, void *user), wtk_run_desc_t const *desc);
+void            wtk_shutdown                 (void);
+int             wtk_input_thread_start       (void);
+void            wtk_input_thread_stop        (void);
+int             wtk_record_begin             (char const *path);
+void            wtk_record_end               (void);
+int             wtk_replay                   (char const *path, int realtime);
+int             wtk_replaying                (void);
+void            wtk_stats                    (wtk_stats_t *stats);
+int             wtk_monitors                 (wtk_monitor_t *monitors, int cap);
+uint64_t        wtk_time_ns                  (void);
+
+void            wtk_window_pos               (wtk_window_t const *window, int *x, int *y);
+void            wtk_window_size              (wtk_window_t const *window, int *w, int *h);
+void            wtk_window_fbsize            (wtk_window_t const *window, int *w, int *h);
+int             wtk_window_closed            (wtk_window_t const *window);
+int             wtk_window_swap_interval     (wtk_window_t const *window);
+int             wtk_window_buffer_age        (wtk_window_t const *window);
+int             wtk_window_frame_stats       (wtk_window_t const *window, wtk_frame_stats_t *stats);
+int             wtk_window_frames            (wtk_window_t const *window, wtk_frame_t *frames, int cap);
+int             wtk_window_monitor           (wtk_window_t const *window, wtk_monitor_t *monitor);
+wtk_native_t    wtk_window_native            (wtk_window_t const *window);
+int             wtk_key_down                 (wtk_window_t const *window, int key);
+int             wtk_button_down              (wtk_window_t const *window, int button);
+
+void            wtk_window_set_pos           (wtk_window_t *window, int x, int y);
+void            wtk_window_set_size          (wtk_window_t *window, int w, int h);
+void            wtk_window_set_title         (wtk_window_t *window, char const *title);
+void            wtk_window_set_closed        (wtk_window_t *window, int closed);
+int             wtk_window_set_swap_interval (wtk_window_t *window, int interval);
 
 ///////////////////////////////////////////////////////////////////////////////
 ///                                                                         ///
@@ -100,10 +259,32 @@ void            wtk_window_set_closed   (wtk_window_t *window, int closed);
 //#if defined(WTK_IMPL)
 
 #include "wtk.h"
-#include <stdlib.h> // calloc, free
+#include <stdlib.h> // calloc, free, qsort
+#include <string.h> // memset, strlen, strstr
 #include <stdio.h>
 
-#if !defined(WTK_API_WIN32) && !defined(WTK_API_X11) && !defined(WTK_API_COCOA) 
+#if defined(_MSC_VER)
+    #define _WTK_THREAD_LOCAL __declspec(thread)
+#else
+    #define _WTK_THREAD_LOCAL __thread
+#endif
+
+// SSE2 and NEON are baseline where they exist; AVX2 is compiled in with a target attribute and picked at runtime
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define _WTK_SSE2
+    #include <emmintrin.h>
+    #if defined(__GNUC__) || defined(__clang__)
+        #define _WTK_AVX2
+        #include <immintrin.h>
+    #endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+    #define _WTK_NEON
+    #include <arm_neon.h>
+#endif
+
+// Define WTK_API_HEADLESS to render offscreen through EGL pbuffers with no display server,
+// or WTK_API_WAYLAND to talk to a Wayland compositor directly instead of going through XWayland
+#if !defined(WTK_API_WIN32) && !defined(WTK_API_X11) && !defined(WTK_API_COCOA) && !defined(WTK_API_HEADLESS) && !defined(WTK_API_WAYLAND)
     #if defined(_WIN32)
         #define WTK_API_WIN32
     #elif defined(__linux__)
@@ -113,6 +294,11 @@ void            wtk_window_set_closed   (wtk_window_t *window, int closed);
     #endif
 #endif
 
+// Define WTK_X11_EGL to drive X11 windows through EGL instead of GLX; events and everything else stay the same
+#if defined(WTK_API_HEADLESS) || defined(WTK_API_WAYLAND) || (defined(WTK_API_X11) && defined(WTK_X11_EGL))
+    #define _WTK_EGL
+#endif
+
 #if defined(WTK_API_WIN32)
     #define WIN32_LEAN_AND_MEAN
     #define NOMINMAX
@@ -122,6 +308,9 @@ void            wtk_window_set_closed   (wtk_window_t *window, int closed);
     // https://gist.github.com/nickrolfe/1127313ed1dbf80254b614a721b3ee9c
     typedef HGLRC WINAPI _WtkWglCreateContextAttribsARBProc(HDC hdc, HGLRC hShareContext, const int *attribList);
     typedef BOOL WINAPI _WtkWglChoosePixelFormatARBProc(HDC hdc, const int *piAttribIList, const FLOAT *pfAttribFList, UINT nMaxFormats, int *piFormats, UINT *nNumFormats);
+    typedef BOOL WINAPI _WtkWglSwapIntervalEXTProc(int interval);
+    typedef int WINAPI _WtkWglGetSwapIntervalEXTProc(void);
+    typedef char const *WINAPI _WtkWglGetExtensionsStringEXTProc(void);
     #define WGL_CONTEXT_MAJOR_VERSION_ARB             0x2091
     #define WGL_CONTEXT_MINOR_VERSION_ARB             0x2092
     #define WGL_CONTEXT_PROFILE_MASK_ARB              0x9126
@@ -136,14 +325,111 @@ void            wtk_window_set_closed   (wtk_window_t *window, int closed);
     #define WGL_STENCIL_BITS_ARB                      0x2023
     #define WGL_FULL_ACCELERATION_ARB                 0x2027
     #define WGL_TYPE_RGBA_ARB                         0x202B
+    #define WGL_SAMPLE_BUFFERS_ARB                    0x2041
+    #define WGL_SAMPLES_ARB                           0x2042
+    #define WGL_FRAMEBUFFER_SRGB_CAPABLE_ARB          0x20A9
+    #define WGL_CONTEXT_FLAGS_ARB                     0x2094
+    #define WGL_CONTEXT_DEBUG_BIT_ARB                 0x00000001
+    #define WGL_CONTEXT_COMPATIBILITY_PROFILE_BIT_ARB 0x00000002
+    #define WGL_CONTEXT_OPENGL_NO_ERROR_ARB           0x31B3
+    #define _WTK_GL_MAJOR 3
+    #define _WTK_GL_MINOR 3
 #elif defined(WTK_API_X11)
     #include <X11/Xlib.h>
     #include <X11/keysym.h>
     #include <X11/XKBlib.h>
+    #include <X11/Xutil.h>
+    #include <X11/extensions/XShm.h>
+    #include <X11/extensions/Xrandr.h>
+    #include <errno.h>
+    #include <fcntl.h>
+    #include <poll.h>
+    #include <pthread.h>
+    #include <sys/ipc.h>
+    #include <sys/shm.h>
+    #include <time.h>
+    #include <unistd.h>
+#if defined(_WTK_EGL)
+    #include <EGL/egl.h>
+    #include <EGL/eglext.h>
+#else
     #include <GL/glx.h>
     typedef GLXContext _WtkGlXCreateContextAttribsARBProc(Display *, GLXFBConfig, GLXContext, Bool, int const *);
+    typedef void _WtkGlXSwapIntervalEXTProc(Display *, GLXDrawable, int);
+    typedef int _WtkGlXSwapIntervalMESAProc(unsigned int);
+    typedef int _WtkGlXGetSwapIntervalMESAProc(void);
+    #ifndef GLX_SWAP_INTERVAL_EXT
+    #define GLX_SWAP_INTERVAL_EXT                     0x20F1
+    #endif
+    #ifndef GLX_LATE_SWAPS_TEAR_EXT
+    #define GLX_LATE_SWAPS_TEAR_EXT                   0x20F3
+    #endif
+    #ifndef GLX_CONTEXT_OPENGL_NO_ERROR_ARB
+    #define GLX_CONTEXT_OPENGL_NO_ERROR_ARB           0x31B3
+    #endif
+    #ifndef GLX_BACK_BUFFER_AGE_EXT
+    #define GLX_BACK_BUFFER_AGE_EXT                   0x20F4
+    #endif
+    #ifndef GLX_FRAMEBUFFER_SRGB_CAPABLE_ARB
+    #define GLX_FRAMEBUFFER_SRGB_CAPABLE_ARB          0x20B2
+    #endif
+#endif
+    #define _WTK_GL_MAJOR 4
+    #define _WTK_GL_MINOR 6
+    #define _WTK_X11_CONFIGS 16
+    typedef struct _WtkX11Config {
+        int key[4]; // Requested samples, srgb, depth and stencil
+        int samples, srgb;
+#if defined(_WTK_EGL)
+        EGLConfig config;
+#else
+        GLXFBConfig fbconfig;
+#endif
+        Visual *visual;
+        int depth;
+        Colormap colormap;
+    } _WtkX11Config;
+#elif defined(WTK_API_WAYLAND)
+    #include <wayland-client.h>
+    #include <wayland-egl.h>
+    #include <xkbcommon/xkbcommon.h>
+    #include <EGL/egl.h>
+    #include <EGL/eglext.h>
+    #include <errno.h>
+    #include <fcntl.h>
+    #include <poll.h>
+    #include <sys/mman.h>
+    #include <time.h>
+    #include <unistd.h>
+    #ifndef EGL_PLATFORM_WAYLAND_KHR
+    #define EGL_PLATFORM_WAYLAND_KHR                  0x31D8
+    #endif
+    #define _WTK_GL_MAJOR 4
+    #define _WTK_GL_MINOR 6
+    #define _WTK_FRAME_TIMEOUT_NS 100000000ull // Longest a swap waits for its frame callback, hidden surfaces never get one
+    #define _WTK_BTN_LEFT 0x110 // Linux input event codes, buttons follow in RIGHT, MIDDLE, SIDE, EXTRA... order
+    // xdg-shell objects, only ever handled through wl_proxy
+    struct xdg_wm_base;
+    struct xdg_surface;
+    struct xdg_toplevel;
+#elif defined(WTK_API_HEADLESS)
+    #include <EGL/egl.h>
+    #include <EGL/eglext.h>
+    #include <errno.h>
+    #include <fcntl.h>
+    #include <poll.h>
+    #include <time.h>
+    #include <unistd.h>
+    #ifndef EGL_PLATFORM_SURFACELESS_MESA
+    #define EGL_PLATFORM_SURFACELESS_MESA             0x31DD
+    #endif
+    #define _WTK_GL_MAJOR 3
+    #define _WTK_GL_MINOR 3
 #elif defined(WTK_API_COCOA)
     #import <Cocoa/Cocoa.h>
+    #include <mach/mach_time.h>
+    #define _WTK_GL_MAJOR 4
+    #define _WTK_GL_MINOR 1
     @interface _WtkCocoaApp : NSObject <NSApplicationDelegate>
     @end
     @interface _WtkCocoaView : NSOpenGLView <NSWindowDelegate>
@@ -151,60 +437,564 @@ void            wtk_window_set_closed   (wtk_window_t *window, int closed);
     @end
 #endif
 
+#if defined(_WTK_EGL)
+    #ifndef EGL_PLATFORM_X11_KHR
+    #define EGL_PLATFORM_X11_KHR                      0x31D5
+    #endif
+    #ifndef EGL_BUFFER_AGE_EXT
+    #define EGL_BUFFER_AGE_EXT                        0x313D
+    #endif
+    #ifndef EGL_CONTEXT_OPENGL_NO_ERROR_KHR
+    #define EGL_CONTEXT_OPENGL_NO_ERROR_KHR           0x31B3
+    #endif
+#endif
+
+#define _WTK_FRAME_HISTORY 128
+#define _WTK_MAX_RECTS 64
+#define _WTK_MAX_MONITORS 16
+#define _WTK_SPIN_NS 1000000        // Waits round to milliseconds or timer ticks, so the end of a paced sleep is spun
+#define _WTK_LATCH_MARGIN_NS 1000000 // Slack a late-latched frame keeps on top of the slowest recent one
+#define _WTK_LATCH_HISTORY 16
+
+// Record/replay log: a header followed by fixed-size records in native byte order, so a log can be mmapped as an array
+#define _WTK_RECORD_MAGIC   0x524b5457u // "WTKR"
+#define _WTK_RECORD_VERSION 4
+typedef struct _WtkRecordHeader {
+    uint32_t magic, version, record_size, reserved;
+} _WtkRecordHeader;
+
+typedef struct _WtkRecord {
+    uint64_t time_ns;   // Event's own time since wtk_record_begin, markers' when the batch ended
+    uint32_t window;    // Creation order of the target window, 0 marks the end of a wtk_poll_events batch
+    int32_t type, key, button, mods;
+    int32_t x, y, dx, dy, merged, repeat;
+    int32_t w, h;       // Window size as of the event, which a replayed WINDOWRESIZE puts back
+} _WtkRecord;
+
 struct wtk_window_t {
     wtk_window_desc_t desc;
     int x, y, closed;
-    wtk_window_t *next;
+    int swap_interval;
+    int gl; // The context exists, which WTK_CONTEXT_LAZY leaves until it's needed
+    struct {
+        wtk_frame_t ring[_WTK_FRAME_HISTORY];
+        unsigned count;
+        uint64_t created_ns, first_ns, last_end_ns, missed;
+        uint64_t presented, msc; // Swap count and vblank counter of the last present the driver reported
+        uint64_t period_ns;      // Refresh period of the window's monitor for estimating missed vblanks
+        int period_known;        // Cleared when the window moves or monitors change
+    } frames;
+    wtk_window_t *next, *prev;
+    uintptr_t handle;
+    uint32_t id; // Creation order since the last wtk_shutdown, which is what logs refer to windows by
+    struct {
+        wtk_event_t *events;
+        unsigned head, tail, mask;
+    } queue;
+    struct {
+        void *data;     // What the last wtk_window_map_pixels returned
+        int w, h, stride;
+        uint32_t *row;  // Scaled blits convert a source row here first, kept so the calls after don't allocate
+        int row_cap;
+    } pixels;
+    struct {
+        wtk_rect_t rect;    // Bounds of the damage not reported yet
+        int pending;        // Number of rects merged into it
+    } expose;
+    int monitor_changed;    // MONITORCHANGE not sent to this window yet
+    struct {
+        uint32_t keys[8];   // Bit per key below 256
+        uint32_t buttons;
+    } input;                // As of the last dispatched event, so replays drive it too
 #if defined(WTK_API_WIN32)
     HWND window;
     HDC device;
     HGLRC context;
+    struct {
+        HDC dc;
+        HBITMAP bitmap, old;
+    } dib;
 #elif defined(WTK_API_X11)
     Window window;
+#if defined(_WTK_EGL)
+    EGLConfig config;
+    EGLSurface surface;
+    EGLContext context;
+#else
     GLXContext context;
+    GLXFBConfig fbconfig;
+    int swap_events; // GLX_INTEL_swap_event selected, which needs the GLX drawable the first make current creates
+#endif
+    Visual *visual;
+    int depth;
+    Colormap colormap; // Only when the config cache was full, cached configs own theirs
+    int mouse_x, mouse_y;
+    int moved, resized;
+    struct {
+        XImage *image[2];       // Only image[0] without MIT-SHM
+        XShmSegmentInfo shm[2];
+        int pending[2];         // Put issued, ShmCompletion not seen yet
+        int current;
+        GC gc;
+    } ximage;
+#elif defined(WTK_API_WAYLAND)
+    struct wl_surface *window;
+    struct xdg_surface *xdg_surface;
+    struct xdg_toplevel *toplevel;
+    struct wl_egl_window *egl_window;
+    EGLConfig config;
+    EGLSurface surface;
+    EGLContext context;
+    struct wl_callback *frame;  // Outstanding wl_surface.frame, cleared when the compositor wants the next frame
+    struct wl_output *output;   // The one the surface entered last
+    int configured;             // The first xdg_surface.configure has been acked
+    int pending_w, pending_h;   // From the last xdg_toplevel.configure, 0 leaves the size to us
+    int mouse_x, mouse_y;
+    int resized;
+    int scroll[2];              // Axis motion not reported yet, in wl_fixed_t
+    wtk_event_t motion;         // Coalesced motion, valid while motion.merged >= 0
+    struct {
+        struct wl_buffer *buffer[2];
+        char *data;             // Both buffers back to back
+        size_t size;            // Of one buffer
+        int busy[2];            // Attached and not released yet
+        int current, w, h;
+    } shm;
+#elif defined(WTK_API_HEADLESS)
+    uintptr_t window; // No native window, just a unique id for the registry
+    EGLConfig config;
+    EGLSurface surface;
+    EGLContext context;
 #elif defined(WTK_API_COCOA)
     NSWindow *window;
     _WtkCocoaView *view;
+    NSView *pixels_view;
+    CGContextRef bitmap;
+#endif
+};
+
+// Windows are carved out of fixed-size slabs so creating many small windows doesn't hit the allocator each time
+#define _WTK_SLAB_SIZE 64
+
+typedef struct _WtkSlab {
+    struct _WtkSlab *next;
+    wtk_window_t windows[_WTK_SLAB_SIZE];
+} _WtkSlab;
+
+// Offscreen context sharing objects with a window, meant to be made current on a worker thread
+struct wtk_context_t {
+    wtk_window_t *window;
+#if defined(WTK_API_WIN32)
+    HGLRC context;
+#elif defined(_WTK_EGL)
+    EGLSurface surface; // EGL_NO_SURFACE with EGL_KHR_surfaceless_context
+    EGLContext context;
+#elif defined(WTK_API_X11)
+    GLXContext context;
+    GLXPbuffer pbuffer;
+#elif defined(WTK_API_COCOA)
+    NSOpenGLContext *context;
 #endif
 };
 
+// The window or context last made current through wtk on this thread
+static _WTK_THREAD_LOCAL void *_wtk_current = NULL;
+
 static struct {
 #if defined(WTK_API_WIN32)
     struct {
         _WtkWglCreateContextAttribsARBProc *wglCreateContextAttribsARB;
         _WtkWglChoosePixelFormatARBProc *wglChoosePixelFormatARB;
+        _WtkWglSwapIntervalEXTProc *wglSwapIntervalEXT;
+        _WtkWglGetSwapIntervalEXTProc *wglGetSwapIntervalEXT;
+        int swap_control_tear;
+        int no_error;
+        DWORD thread;   // Where the windows live and wakeups go
     } win32;
 #elif defined(WTK_API_X11)
     struct {
+#if !defined(_WTK_EGL)
         _WtkGlXCreateContextAttribsARBProc *glx_create_ctx_attribs;
+        _WtkGlXSwapIntervalEXTProc *glx_swap_interval_ext;
+        _WtkGlXSwapIntervalMESAProc *glx_swap_interval_mesa;
+        _WtkGlXGetSwapIntervalMESAProc *glx_get_swap_interval_mesa;
+        int glx_swap_complete;  // Event type of GLX_INTEL_swap_event's completions, 0 without it
+        int glx_swap_control_tear;
+        int glx_no_error, glx_srgb, glx_buffer_age;
+#endif
         Display *display;
-        XContext context;
-        Visual *visual;
         Window root;
-        Colormap colormap;
         Atom wm_delwin;
+        _WtkX11Config configs[_WTK_X11_CONFIGS]; // Chosen framebuffer configs, keyed by what was asked for
+        int config_count;
         int screen;
-        int depth;
+        int (*error_handler)(Display *, XErrorEvent *); // Whoever had it before wtk_init, gets every error not trapped
+        struct { unsigned long serial; int error, active; } trap; // Errors from serial on are the trapper's
+        int shm, shm_completion;
+        int wakeup[2];
+        int xkb_event;
+        int randr_event;    // -1 without RandR 1.3
+        int keymap[256][2]; // [keycode][shifted] -> WTK_KEY_*
+        struct { int key, down; } held[256]; // [keycode], so a release reports the key its press did
+        uint64_t time;      // Receive time of the event being processed
+        struct {
+            struct { XEvent event; uint64_t time; } *ring; // Single producer (input thread), single consumer
+            unsigned head, tail, mask;
+            int done;
+            pthread_t thread;
+            Window helper;
+            Atom stop;
+        } input;
     } x11;
+#elif defined(WTK_API_WAYLAND)
+    struct {
+        struct wl_display *display;
+        struct wl_registry *registry;
+        struct wl_compositor *compositor;
+        struct wl_shm *shm;
+        struct wl_seat *seat;
+        struct wl_pointer *pointer;
+        struct wl_keyboard *keyboard;
+        struct xdg_wm_base *wm_base;
+        struct wl_event_queue *queue; // Frame callbacks and buffer releases, which wtk waits on without running user callbacks
+        uint32_t compositor_version;
+        struct {
+            struct wl_output *output;   // NULL for a free slot
+            uint32_t name;              // Registry name, which global_remove refers to
+            wtk_monitor_t monitor;
+            int transform, scale, mode_w, mode_h;
+        } outputs[_WTK_MAX_MONITORS];   // Slots never move, their index is the listener data
+        struct xkb_context *xkb;
+        struct xkb_keymap *keymap;
+        struct xkb_state *state;
+        int keys[256][2];   // [keycode][shifted] -> WTK_KEY_*
+        struct { int key, down; } held[256]; // [keycode], so a release reports the key its press did
+        int mods;
+        wtk_window_t *pointer_focus, *keyboard_focus;
+        uint64_t time;      // When the events being dispatched were read
+        int wakeup[2];
+    } wayland;
+#elif defined(WTK_API_HEADLESS)
+    struct {
+        uintptr_t next_id;
+        int wakeup[2];
+    } headless;
 #elif defined(WTK_API_COCOA)
     struct {
         _WtkCocoaApp *app;
     } cocoa;
 #endif
+#if defined(_WTK_EGL)
+    struct {
+        EGLDisplay display;
+        PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC swap_with_damage;
+        int no_error, colorspace, buffer_age, surfaceless;
+    } egl;
+#endif
+    struct {
+        wtk_window_t **slots;   // Open-addressed hash of native handle -> window
+        wtk_window_t *last;     // Last lookup hit, nearly always the answer with a single window
+        wtk_window_t *free_list;
+        _WtkSlab *slabs;
+        unsigned mask, count;
+    } registry;
+    struct {
+        FILE *file;
+        uint64_t start;
+        unsigned pending;   // Records written since the last batch marker
+    } record;
+    struct {
+        FILE *file;
+        uint64_t start;
+        _WtkRecord next;    // Lookahead, valid while file is open
+        int realtime;
+        int feeding;        // Set while replayed events are dispatched, live ones are dropped otherwise
+    } replay;
+    wtk_stats_t stats;
+    struct {
+        wtk_monitor_t list[_WTK_MAX_MONITORS]; // Primary first
+        int count;
+        int valid;      // Cleared by the backend when the configuration changes
+        int changed;    // MONITORCHANGE not sent yet
+    } monitors;
     wtk_window_t *window_list;
+    uint32_t next_window_id;
+    uint32_t deleted; // Bumped by wtk_window_delete, so walks over window_list notice a callback deleting windows
+    int initialized; // The native connection stays open from the first window until wtk_shutdown
 } _wtk = {0};
 
+static void _wtk_dispatch_event(wtk_window_t *window, wtk_event_t const *event);
+static void _wtk_window_damage(wtk_window_t *window, wtk_rect_t rect);
+#if !defined(WTK_API_HEADLESS)
+static void _wtk_monitors_changed(void);
+#endif
+#if defined(WTK_API_WIN32) || defined(WTK_API_X11) || defined(WTK_API_WAYLAND)
+static wtk_window_t *_wtk_window_find(uintptr_t handle);
+#endif
+#if defined(WTK_API_X11) && !defined(_WTK_EGL)
+static void _wtk_frame_presented(wtk_window_t *window, uint64_t sbc, uint64_t ust_ns, uint64_t msc);
+#endif
+
+// Fallback chain for framebuffer attributes, returns 0 once there is nothing left to give up
+static int _wtk_relax_pixel_format(wtk_gl_desc_t *gl) {
+    if (gl->samples) { gl->samples = 0; return 1; }
+    if (gl->srgb)    { gl->srgb = 0;    return 1; }
+    return 0;
+}
+
+// Fallback chain for context attributes, ending at whatever the legacy entry point gives (major == 0)
+static int _wtk_relax_context(wtk_gl_desc_t *gl) {
+    if (gl->no_error)                      { gl->no_error = 0; return 1; }
+    if (gl->debug)                         { gl->debug = 0;    return 1; }
+    if (gl->major > 4)                     { gl->major = 4; gl->minor = 6; return 1; }
+    if (gl->major >= 4 && gl->minor > 0)   { gl->minor--;      return 1; }
+    if (gl->major >= 4)                    { gl->major = 3; gl->minor = 3; return 1; }
+    if (gl->major == 3 && gl->minor > 2)   { gl->minor = 2;    return 1; }
+    if (gl->major)                         { gl->major = gl->minor = 0; return 1; }
+    return 0;
+}
+
+#if !defined(WTK_API_COCOA)
+static int _wtk_has_extension(char const *extensions, char const *name) {
+    size_t len = strlen(name);
+    for (char const *p = extensions; p && (p = strstr(p, name)); p += len)
+        if ((p == extensions || p[-1] == ' ') && (p[len] == ' ' || p[len] == '\0'))
+            return 1;
+    return 0;
+}
+#endif
+
+// EGL {{{
+
+// Shared by the headless backend and X11 with WTK_X11_EGL; windows and contexts have the same EGL fields in both
+
+#if defined(_WTK_EGL)
+
+static int _wtk_egl_init(EGLDisplay display) {
+    _wtk.egl.display = display;
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL))
+        return 0;
+
+    if (!eglBindAPI(EGL_OPENGL_API)) {
+        eglTerminate(display);
+        return 0;
+    }
+
+    char const *extensions = eglQueryString(display, EGL_EXTENSIONS);
+    _wtk.egl.no_error = _wtk_has_extension(extensions, "EGL_KHR_create_context_no_error");
+    _wtk.egl.colorspace = _wtk_has_extension(extensions, "EGL_KHR_gl_colorspace");
+    _wtk.egl.buffer_age = _wtk_has_extension(extensions, "EGL_EXT_buffer_age");
+    _wtk.egl.surfaceless = _wtk_has_extension(extensions, "EGL_KHR_surfaceless_context");
+    if (_wtk_has_extension(extensions, "EGL_KHR_swap_buffers_with_damage"))
+        _wtk.egl.swap_with_damage = (PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC)eglGetProcAddress("eglSwapBuffersWithDamageKHR");
+    else if (_wtk_has_extension(extensions, "EGL_EXT_swap_buffers_with_damage"))
+        _wtk.egl.swap_with_damage = (PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC)eglGetProcAddress("eglSwapBuffersWithDamageEXT");
+
+    return 1;
+}
+
+static void _wtk_egl_quit(void) {
+    eglMakeCurrent(_wtk.egl.display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    eglTerminate(_wtk.egl.display);
+}
+
+// X11 picks its own, a config is only usable there if it comes with a visual
+#if !defined(WTK_API_X11)
+static EGLConfig _wtk_egl_choose_config(wtk_gl_desc_t *gl, EGLint surface_type) {
+    if (!_wtk.egl.colorspace)
+        gl->srgb = 0;
+
+    for (;;) {
+        // Windows stay opaque so the compositor doesn't blend them, pbuffers keep alpha for reading back
+        EGLint attribs[] = {
+            EGL_SURFACE_TYPE,       surface_type,
+            EGL_RENDERABLE_TYPE,    EGL_OPENGL_BIT,
+            EGL_RED_SIZE,           8,
+            EGL_GREEN_SIZE,         8,
+            EGL_BLUE_SIZE,          8,
+            EGL_ALPHA_SIZE,         surface_type & EGL_WINDOW_BIT ? 0 : 8,
+            EGL_DEPTH_SIZE,         gl->depth_bits,
+            EGL_STENCIL_SIZE,       gl->stencil_bits,
+            EGL_SAMPLE_BUFFERS,     gl->samples ? 1 : 0,
+            EGL_SAMPLES,            gl->samples,
+            EGL_NONE
+        };
+
+        // Sizes are minimums and sorted smallest first, so the first match wastes the least
+        EGLConfig config;
+        EGLint count = 0;
+        if (eglChooseConfig(_wtk.egl.display, attribs, &config, 1, &count) && count)
+            return config;
+
+        if (!_wtk_relax_pixel_format(gl))
+            return NULL;
+    }
+}
+#endif
+
+static EGLContext _wtk_egl_create_context(EGLConfig config, EGLContext share, wtk_gl_desc_t *gl) {
+    for (;;) {
+        EGLint attribs[16], n = 0;
+        if (gl->major) {
+            attribs[n++] = EGL_CONTEXT_MAJOR_VERSION_KHR;   attribs[n++] = gl->major;
+            attribs[n++] = EGL_CONTEXT_MINOR_VERSION_KHR;   attribs[n++] = gl->minor;
+            if (gl->major * 10 + gl->minor >= 32) {
+                attribs[n++] = EGL_CONTEXT_OPENGL_PROFILE_MASK_KHR;
+                attribs[n++] = gl->profile == WTK_GL_PROFILE_COMPAT ? EGL_CONTEXT_OPENGL_COMPATIBILITY_PROFILE_BIT_KHR : EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT_KHR;
+            }
+        }
+        if (gl->debug) {
+            attribs[n++] = EGL_CONTEXT_FLAGS_KHR;           attribs[n++] = EGL_CONTEXT_OPENGL_DEBUG_BIT_KHR;
+        }
+        if (gl->no_error && _wtk.egl.no_error) {
+            attribs[n++] = EGL_CONTEXT_OPENGL_NO_ERROR_KHR; attribs[n++] = EGL_TRUE;
+        }
+        attribs[n++] = EGL_NONE;
+
+        EGLContext context = eglCreateContext(_wtk.egl.display, config, share, attribs);
+        if (context != EGL_NO_CONTEXT || !_wtk_relax_context(gl))
+            return context;
+    }
+}
+
+// Surface attributes for window->desc.gl, with room for the caller's own in front
+static EGLint *_wtk_egl_surface_attribs(wtk_window_t const *window, EGLint *attribs, int n) {
+    if (window->desc.gl.srgb) {
+        attribs[n++] = EGL_GL_COLORSPACE_KHR;
+        attribs[n++] = EGL_GL_COLORSPACE_SRGB_KHR;
+    }
+    attribs[n] = EGL_NONE;
+    return attribs;
+}
+
+static void _wtk_window_make_current(wtk_window_t *window) {
+    eglMakeCurrent(_wtk.egl.display, window->surface, window->surface, window->context);
+}
+
+static void _wtk_egl_swap_buffers(wtk_window_t *window, wtk_rect_t const *rects, int n) {
+    if (n > 0 && n <= _WTK_MAX_RECTS && _wtk.egl.swap_with_damage) {
+        // EGL counts rows from the bottom
+        EGLint damage[_WTK_MAX_RECTS * 4];
+        for (int i = 0; i < n; i++) {
+            damage[i * 4 + 0] = rects[i].x;
+            damage[i * 4 + 1] = window->desc.h - rects[i].y - rects[i].h;
+            damage[i * 4 + 2] = rects[i].w;
+            damage[i * 4 + 3] = rects[i].h;
+        }
+        _wtk.egl.swap_with_damage(_wtk.egl.display, window->surface, damage, n);
+    } else {
+        eglSwapBuffers(_wtk.egl.display, window->surface);
+    }
+}
+
+// EGL has no query for it, but every surface starts out at 1
+static int _wtk_window_query_swap_interval(wtk_window_t *window) {
+    (void)window;
+    return 1;
+}
+
+// Wayland paces swaps itself and brings its own versions of these two
+#if !defined(WTK_API_WAYLAND)
+static void _wtk_window_swap_buffers(wtk_window_t *window, wtk_rect_t const *rects, int n) {
+    _wtk_egl_swap_buffers(window, rects, n);
+}
+
+static int _wtk_window_set_swap_interval(wtk_window_t *window, int interval) {
+    // EGL has no adaptive vsync, and the interval applies to the current surface. The window is only current for
+    // the call, whatever was current before is put back
+    interval = interval < 0 ? -interval : interval;
+    EGLContext context = eglGetCurrentContext();
+    EGLSurface draw = eglGetCurrentSurface(EGL_DRAW), read = eglGetCurrentSurface(EGL_READ);
+    _wtk_window_make_current(window);
+    EGLBoolean set = eglSwapInterval(_wtk.egl.display, interval);
+    eglMakeCurrent(_wtk.egl.display, draw, read, context);
+    return set ? interval : window->swap_interval;
+}
+#endif
+
+static int _wtk_window_buffer_age(wtk_window_t const *window) {
+    EGLint age = 0;
+    if (_wtk.egl.buffer_age && _wtk_current == window)
+        eglQuerySurface(_wtk.egl.display, window->surface, EGL_BUFFER_AGE_EXT, &age);
+    return age;
+}
+
+static int _wtk_context_create(wtk_context_t *context) {
+    // Without surfaceless contexts, borrow a tiny pbuffer, which needs a config that has them
+    if (!_wtk.egl.surfaceless) {
+        EGLint attribs[8] = {EGL_WIDTH, 1, EGL_HEIGHT, 1};
+        context->surface = eglCreatePbufferSurface(_wtk.egl.display, context->window->config, _wtk_egl_surface_attribs(context->window, attribs, 4));
+        if (context->surface == EGL_NO_SURFACE)
+            return 0;
+    }
+
+    wtk_gl_desc_t gl = context->window->desc.gl;
+    context->context = _wtk_egl_create_context(context->window->config, context->window->context, &gl);
+    return context->context != EGL_NO_CONTEXT;
+}
+
+static void _wtk_context_make_current(wtk_context_t *context) {
+    // The bound API is per thread, and workers start out bound to GLES
+    eglBindAPI(EGL_OPENGL_API);
+    if (context)
+        eglMakeCurrent(_wtk.egl.display, context->surface, context->surface, context->context);
+    else
+        eglMakeCurrent(_wtk.egl.display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+}
+
+static void _wtk_context_delete(wtk_context_t *context) {
+    if (context->context)
+        eglDestroyContext(_wtk.egl.display, context->context);
+    if (context->surface)
+        eglDestroySurface(_wtk.egl.display, context->surface);
+}
+
+static void _wtk_egl_window_delete(wtk_window_t *window) {
+    if (window->context && eglGetCurrentContext() == window->context)
+        eglMakeCurrent(_wtk.egl.display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (window->context)
+        eglDestroyContext(_wtk.egl.display, window->context);
+    if (window->surface)
+        eglDestroySurface(_wtk.egl.display, window->surface);
+}
+
+#endif // _WTK_EGL
+
+// }}}
 // Win32 {{{
 
 #if defined(WTK_API_WIN32)
 
+static uint64_t _wtk_time_ns(void) {
+    static LARGE_INTEGER freq;
+    if (!freq.QuadPart)
+        QueryPerformanceFrequency(&freq);
+
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return (uint64_t)(counter.QuadPart / freq.QuadPart) * 1000000000ull + (uint64_t)(counter.QuadPart % freq.QuadPart) * 1000000000ull / (uint64_t)freq.QuadPart;
+}
+
 static LRESULT CALLBACK _wtk_window_proc(HWND wnd, UINT msg, WPARAM wparam, LPARAM lparam) {
-    wtk_window_t *window = (wtk_window_t *)GetWindowLongPtr(wnd, GWLP_USERDATA);
+    wtk_window_t *window = _wtk_window_find((uintptr_t)wnd);
+    if (!window)
+        return DefWindowProc(wnd, msg, wparam, lparam);
 
     switch (msg) {
         case WM_CLOSE: {
             wtk_window_set_closed(window, 1);
-            window->desc.callback(window, &(wtk_event_t){.type = WTK_EVENTTYPE_WINDOWCLOSE});
+            _wtk_dispatch_event(window, &(wtk_event_t){.type = WTK_EVENTTYPE_WINDOWCLOSE});
+        } return 0;
+
+        case WM_DISPLAYCHANGE: {
+            _wtk_monitors_changed();
+        } break;
+
+        case WM_PAINT: {
+            RECT rect;
+            if (GetUpdateRect(wnd, &rect, FALSE))
+                _wtk_window_damage(window, (wtk_rect_t){rect.left, rect.top, rect.right - rect.left, rect.bottom - rect.top});
+            ValidateRect(wnd, NULL);
         } return 0;
 
         default: {
@@ -214,7 +1004,9 @@ static LRESULT CALLBACK _wtk_window_proc(HWND wnd, UINT msg, WPARAM wparam, LPAR
     return DefWindowProc(wnd, msg, wparam, lparam);
 }
 
-static int _wtk_init(void) {
+// Extensions can only be looked up with a context current, which takes a throwaway window and context. All of it
+// is released again whether or not that worked
+static int _wtk_wgl_load_extensions(void) {
     WNDCLASS wnd_class = {
         .style = CS_HREDRAW | CS_VREDRAW | CS_OWNDC,
         .lpfnWndProc = DefWindowProc,
@@ -230,14 +1022,11 @@ static int _wtk_init(void) {
         CW_USEDEFAULT, CW_USEDEFAULT, CW_USEDEFAULT, CW_USEDEFAULT,
         0, 0, wnd_class.hInstance, 0
     );
-
-    if (!dummy_wnd)
-        return 0;
-
-    HDC dummy_dc = GetDC(dummy_wnd);
+    HDC dummy_dc = dummy_wnd ? GetDC(dummy_wnd) : NULL;
+    HGLRC dummy_ctx = NULL;
 
     PIXELFORMATDESCRIPTOR pfd = {
-        .nsize = sizeof pfd,
+        .nSize = sizeof pfd,
         .nVersion = 1,
         .iPixelType = PFD_TYPE_RGBA,
         .dwFlags = PFD_DRAW_TO_WINDOW | PFD_SUPPORT_OPENGL | PFD_DOUBLEBUFFER,
@@ -248,37 +1037,42 @@ static int _wtk_init(void) {
         .cStencilBits = 8,
     };
 
-    int pixel_format = ChoosePixelFormat(dummy_dc, &pfd);
-    if (!pixel_format)
-        return 0;
-
-    if (!SetPixelFormat(dummy_dc, pixel_format, &pfd))
-        return 0;
-
-    HGLRC dummy_ctx = wglCreateContext(dummy_dc);
-    if (!dummy_ctx)
-        return 0;
-
-    if (!wglMakeCurrent(dummy_dc, dummy_ctx))
-        return 0;
-
-    _wtk.win32.wglCreateContextAttribsARB = (_WtkWglCreateContextAttribsARBProc *)wglGetProcAddress("wglCreateContextAttribsARB");
-    _wtk.win32.wglChoosePixelFormatARB = (_WtkWglChoosePixelFormatARBProc *)wglGetProcAddress("wglChoosePixelFormatARB");
+    int loaded = 0;
+    int pixel_format = dummy_dc ? ChoosePixelFormat(dummy_dc, &pfd) : 0;
+    if (pixel_format && SetPixelFormat(dummy_dc, pixel_format, &pfd) && (dummy_ctx = wglCreateContext(dummy_dc)) && wglMakeCurrent(dummy_dc, dummy_ctx)) {
+        _wtk.win32.wglCreateContextAttribsARB = (_WtkWglCreateContextAttribsARBProc *)wglGetProcAddress("wglCreateContextAttribsARB");
+        _wtk.win32.wglChoosePixelFormatARB = (_WtkWglChoosePixelFormatARBProc *)wglGetProcAddress("wglChoosePixelFormatARB");
+        _wtk.win32.wglSwapIntervalEXT = (_WtkWglSwapIntervalEXTProc *)wglGetProcAddress("wglSwapIntervalEXT");
+        _wtk.win32.wglGetSwapIntervalEXT = (_WtkWglGetSwapIntervalEXTProc *)wglGetProcAddress("wglGetSwapIntervalEXT");
+
+        _WtkWglGetExtensionsStringEXTProc *wglGetExtensionsStringEXT = (_WtkWglGetExtensionsStringEXTProc *)wglGetProcAddress("wglGetExtensionsStringEXT");
+        if (wglGetExtensionsStringEXT) {
+            _wtk.win32.swap_control_tear = _wtk_has_extension(wglGetExtensionsStringEXT(), "WGL_EXT_swap_control_tear");
+            _wtk.win32.no_error = _wtk_has_extension(wglGetExtensionsStringEXT(), "WGL_ARB_create_context_no_error");
+        }
 
-    wglMakeCurrent(dummy_dc, 0);
-    wglDeleteContext(dummy_ctx);
-    ReleaseDC(dummy_wnd, dummy_dc);
-    DestroyWindow(dummy_wnd);
+        wglMakeCurrent(dummy_dc, 0);
+        loaded = 1;
+    }
 
-    return 1;
+    if (dummy_ctx)
+        wglDeleteContext(dummy_ctx);
+    if (dummy_dc)
+        ReleaseDC(dummy_wnd, dummy_dc);
+    if (dummy_wnd)
+        DestroyWindow(dummy_wnd);
+    UnregisterClass(wnd_class.lpszClassName, wnd_class.hInstance);
+    return loaded;
 }
 
-static void _wtk_quit(void) {
-    // Move along...
-}
+static int _wtk_init(void) {
+    // Wakeups are posted to this thread, the one that creates windows and pumps their messages
+    _wtk.win32.thread = GetCurrentThreadId();
 
-static int _wtk_window_create(wtk_window_t *window) {
-    WNDCLASS wnd_class = {
+    if (!_wtk_wgl_load_extensions())
+        return 0;
+
+    WNDCLASS window_class = {
         .style = CS_OWNDC,
         .lpfnWndProc = _wtk_window_proc,
         .hInstance = GetModuleHandle(NULL),
@@ -286,14 +1080,82 @@ static int _wtk_window_create(wtk_window_t *window) {
         .lpszClassName = "wtk_window_tClass",
     };
 
-    if (!RegisterClass(&wnd_class))
-        return 0;
+    return RegisterClass(&window_class) != 0;
+}
+
+static void _wtk_quit(void) {
+    UnregisterClass("wtk_window_tClass", GetModuleHandle(NULL));
+}
+
+static int _wtk_wgl_choose_pixel_format(HDC device, wtk_gl_desc_t *gl) {
+    for (;;) {
+        int attribs[32], n = 0;
+        attribs[n++] = WGL_DRAW_TO_WINDOW_ARB;  attribs[n++] = GL_TRUE;
+        attribs[n++] = WGL_SUPPORT_OPENGL_ARB;  attribs[n++] = GL_TRUE;
+        attribs[n++] = WGL_DOUBLE_BUFFER_ARB;   attribs[n++] = GL_TRUE;
+        attribs[n++] = WGL_ACCELERATION_ARB;    attribs[n++] = WGL_FULL_ACCELERATION_ARB;
+        attribs[n++] = WGL_PIXEL_TYPE_ARB;      attribs[n++] = WGL_TYPE_RGBA_ARB;
+        attribs[n++] = WGL_COLOR_BITS_ARB;      attribs[n++] = 32;
+        attribs[n++] = WGL_DEPTH_BITS_ARB;      attribs[n++] = gl->depth_bits;
+        attribs[n++] = WGL_STENCIL_BITS_ARB;    attribs[n++] = gl->stencil_bits;
+        if (gl->samples) {
+            attribs[n++] = WGL_SAMPLE_BUFFERS_ARB;  attribs[n++] = 1;
+            attribs[n++] = WGL_SAMPLES_ARB;         attribs[n++] = gl->samples;
+        }
+        if (gl->srgb) {
+            attribs[n++] = WGL_FRAMEBUFFER_SRGB_CAPABLE_ARB; attribs[n++] = GL_TRUE;
+        }
+        attribs[n++] = 0;
+
+        int pixel_format;
+        UINT num_formats = 0;
+        if (_wtk.win32.wglChoosePixelFormatARB(device, attribs, 0, 1, &pixel_format, &num_formats) && num_formats)
+            return pixel_format;
+
+        if (!_wtk_relax_pixel_format(gl))
+            return 0;
+    }
+}
+
+static HGLRC _wtk_wgl_create_context(HDC device, HGLRC share, wtk_gl_desc_t *gl) {
+    for (;;) {
+        HGLRC context = NULL;
+
+        if (!gl->major) {
+            if ((context = wglCreateContext(device)) && share && !wglShareLists(share, context)) {
+                wglDeleteContext(context);
+                context = NULL;
+            }
+        } else {
+            int attribs[16], n = 0;
+            attribs[n++] = WGL_CONTEXT_MAJOR_VERSION_ARB;   attribs[n++] = gl->major;
+            attribs[n++] = WGL_CONTEXT_MINOR_VERSION_ARB;   attribs[n++] = gl->minor;
+            if (gl->major * 10 + gl->minor >= 32) {
+                attribs[n++] = WGL_CONTEXT_PROFILE_MASK_ARB;
+                attribs[n++] = gl->profile == WTK_GL_PROFILE_COMPAT ? WGL_CONTEXT_COMPATIBILITY_PROFILE_BIT_ARB : WGL_CONTEXT_CORE_PROFILE_BIT_ARB;
+            }
+            if (gl->debug) {
+                attribs[n++] = WGL_CONTEXT_FLAGS_ARB;       attribs[n++] = WGL_CONTEXT_DEBUG_BIT_ARB;
+            }
+            if (gl->no_error && _wtk.win32.no_error) {
+                attribs[n++] = WGL_CONTEXT_OPENGL_NO_ERROR_ARB; attribs[n++] = GL_TRUE;
+            }
+            attribs[n++] = 0;
+
+            context = _wtk.win32.wglCreateContextAttribsARB(device, share, attribs);
+        }
 
+        if (context || !_wtk_relax_context(gl))
+            return context;
+    }
+}
+
+static int _wtk_window_create(wtk_window_t *window) {
     RECT rect = { .right = window->desc.w, .bottom = window->desc.h };
     AdjustWindowRect(&rect, WS_OVERLAPPEDWINDOW, 0);
 
     window->window = CreateWindow(
-        wnd_class.lpszClassName, window->desc.title,
+        "wtk_window_tClass", window->desc.title,
         WS_OVERLAPPEDWINDOW,
         CW_USEDEFAULT, CW_USEDEFAULT, rect.right - rect.left, rect.bottom - rect.top,
         NULL, NULL, GetModuleHandle(NULL), NULL
@@ -303,23 +1165,14 @@ static int _wtk_window_create(wtk_window_t *window) {
         return 0;
 
     window->device = GetDC(window->window);
+    ShowWindow(window->window, SW_SHOW);
+    return 1;
+}
 
-    int pf_attribs[] = {
-        WGL_DRAW_TO_WINDOW_ARB,     GL_TRUE,
-        WGL_SUPPORT_OPENGL_ARB,     GL_TRUE,
-        WGL_DOUBLE_BUFFER_ARB,      GL_TRUE,
-        WGL_ACCELERATION_ARB,       WGL_FULL_ACCELERATION_ARB,
-        WGL_PIXEL_TYPE_ARB,         WGL_TYPE_RGBA_ARB,
-        WGL_COLOR_BITS_ARB,         32,
-        WGL_DEPTH_BITS_ARB,         24,
-        WGL_STENCIL_BITS_ARB,       8,
-        0
-    };
-
-    int pixel_format;
-    UINT num_formats;
-    _wtk.win32.wglChoosePixelFormatARB(window->device, pf_attribs, 0, 1, &pixel_format, &num_formats);
-    if (!num_formats)
+static int _wtk_window_create_context(wtk_window_t *window) {
+    // A DC's pixel format can only be set once, so a window without GL stays free for Vulkan to pick its own
+    int pixel_format = _wtk_wgl_choose_pixel_format(window->device, &window->desc.gl);
+    if (!pixel_format)
         return 0;
 
     PIXELFORMATDESCRIPTOR pfd;
@@ -327,29 +1180,56 @@ static int _wtk_window_create(wtk_window_t *window) {
     if (!SetPixelFormat(window->device, pixel_format, &pfd))
         return 0;
 
-    int ctx_attribs[] = {
-        WGL_CONTEXT_MAJOR_VERSION_ARB, 3,
-        WGL_CONTEXT_MINOR_VERSION_ARB, 3,
-        WGL_CONTEXT_PROFILE_MASK_ARB,  WGL_CONTEXT_CORE_PROFILE_BIT_ARB,
-        0,
-    };
-
-    window->context = _wtk.win32.wglCreateContextAttribsARB(window->device, 0, ctx_attribs);
-    if (!window->context)
-        return 0;
-
-    ShowWindow(window->window, SW_SHOW);
-    return 1;
+    window->context = _wtk_wgl_create_context(window->device, NULL, &window->desc.gl);
+    return window->context != NULL;
 }
 
 static void _wtk_window_make_current(wtk_window_t *window) {
     wglMakeCurrent(window->device, window->context);
 }
 
-static void _wtk_window_swap_buffers(wtk_window_t *window) {
+static void _wtk_window_swap_buffers(wtk_window_t *window, wtk_rect_t const *rects, int n) {
+    (void)rects; (void)n;
     SwapBuffers(window->device);
 }
 
+static int _wtk_window_buffer_age(wtk_window_t const *window) {
+    (void)window;
+    return 0;
+}
+
+static int _wtk_window_query_swap_interval(wtk_window_t *window) {
+    if (!_wtk.win32.wglGetSwapIntervalEXT)
+        return 0;
+
+    // Like setting it, asks whichever context is current
+    HGLRC context = wglGetCurrentContext();
+    HDC dc = wglGetCurrentDC();
+    _wtk_window_make_current(window);
+    int interval = _wtk.win32.wglGetSwapIntervalEXT();
+    wglMakeCurrent(dc, context);
+    return interval;
+}
+
+static int _wtk_window_set_swap_interval(wtk_window_t *window, int interval) {
+    if (!_wtk.win32.wglSwapIntervalEXT)
+        return window->swap_interval;
+
+    if (interval < 0 && !_wtk.win32.swap_control_tear)
+        interval = -interval;
+
+    // WGL_EXT_swap_control applies to whichever context is current. The window is only current for the call,
+    // whatever was current before is put back
+    HGLRC context = wglGetCurrentContext();
+    HDC dc = wglGetCurrentDC();
+    _wtk_window_make_current(window);
+    _wtk.win32.wglSwapIntervalEXT(interval);
+    if (_wtk.win32.wglGetSwapIntervalEXT)
+        interval = _wtk.win32.wglGetSwapIntervalEXT();
+    wglMakeCurrent(dc, context);
+    return interval;
+}
+
 static void _wtk_poll_events(void) {
     for (MSG msg; PeekMessage(&msg, NULL, 0, 0, PM_REMOVE);) {
         TranslateMessage(&msg);
@@ -357,10 +1237,102 @@ static void _wtk_poll_events(void) {
     }
 }
 
+static void _wtk_wait_events(int64_t timeout) {
+    if (timeout < 0) {
+        WaitMessage();
+    } else {
+        // Capped well below INFINITE, which would turn a long timeout into no timeout at all
+        DWORD ms = timeout / 1000000 > 0x7fffffff ? 0x7fffffff : (DWORD)((timeout + 999999) / 1000000);
+        MsgWaitForMultipleObjects(0, NULL, FALSE, ms, QS_ALLINPUT);
+    }
+    _wtk_poll_events();
+}
+
+static void _wtk_post_empty_event(void) {
+    // Callable from any thread; a thread message needs no window, so there is no window list to race on
+    PostThreadMessage(_wtk.win32.thread, WM_NULL, 0, 0);
+}
+
+static int _wtk_input_thread_start(void) {
+    // Messages can only be pumped on the thread that created the windows
+    return 0;
+}
+
+static void _wtk_input_thread_stop(void) {
+}
+
+static int _wtk_context_create(wtk_context_t *context) {
+    // The worker borrows the window's DC, which carries the pixel format the shared context needs
+    wtk_gl_desc_t gl = context->window->desc.gl;
+    context->context = _wtk_wgl_create_context(context->window->device, context->window->context, &gl);
+    return context->context != NULL;
+}
+
+static void _wtk_context_make_current(wtk_context_t *context) {
+    if (context)
+        wglMakeCurrent(context->window->device, context->context);
+    else
+        wglMakeCurrent(NULL, NULL);
+}
+
+static void _wtk_context_delete(wtk_context_t *context) {
+    wglDeleteContext(context->context);
+}
+
+static void _wtk_destroy_dib(wtk_window_t *window) {
+    if (window->dib.dc) {
+        SelectObject(window->dib.dc, window->dib.old);
+        DeleteDC(window->dib.dc);
+    }
+    if (window->dib.bitmap)
+        DeleteObject(window->dib.bitmap);
+    window->dib.dc = NULL;
+    window->dib.bitmap = NULL;
+}
+
+static void *_wtk_window_map_pixels(wtk_window_t *window, int w, int h, int *stride) {
+    void *bits = window->pixels.data;
+    if (!window->dib.bitmap || window->pixels.w != w || window->pixels.h != h) {
+        _wtk_destroy_dib(window);
+
+        // A negative height makes the section top-down like every other backend
+        BITMAPINFO bmi = {.bmiHeader = {
+            .biSize        = sizeof(BITMAPINFOHEADER),
+            .biWidth       = w,
+            .biHeight      = -h,
+            .biPlanes      = 1,
+            .biBitCount    = 32,
+            .biCompression = BI_RGB,
+        }};
+
+        if (!(window->dib.bitmap = CreateDIBSection(window->device, &bmi, DIB_RGB_COLORS, &bits, NULL, 0)))
+            return NULL;
+        if (!(window->dib.dc = CreateCompatibleDC(window->device))) {
+            _wtk_destroy_dib(window);
+            return NULL;
+        }
+        window->dib.old = SelectObject(window->dib.dc, window->dib.bitmap);
+    }
+
+    // GDI may still be reading the section from the last present
+    GdiFlush();
+    *stride = w * 4;
+    return bits;
+}
+
+static void _wtk_window_present_pixels(wtk_window_t *window, wtk_rect_t const *rects, int n, int preserve) {
+    (void)preserve;
+    for (int i = 0; i < n; i++)
+        BitBlt(window->device, rects[i].x, rects[i].y, rects[i].w, rects[i].h, window->dib.dc, rects[i].x, rects[i].y, SRCCOPY);
+    GdiFlush();
+}
+
 static void _wtk_window_delete(wtk_window_t *window) {
+    _wtk_destroy_dib(window);
     ReleaseDC(window->window, window->device);
     DestroyWindow(window->window);
-    wglDeleteContext(window->context);
+    if (window->context)
+        wglDeleteContext(window->context);
 }
 
 static void _wtk_window_set_pos(wtk_window_t *window, int x, int y) {
@@ -375,15 +1347,73 @@ static void _wtk_window_set_title(wtk_window_t *window, char const *title) {
     SetWindowText(window->window, title);
 }
 
-// }}}
-// X11 {{{
+typedef struct _WtkMonitorEnum {
+    wtk_monitor_t *monitors;
+    int cap, count;
+    float scale;
+} _WtkMonitorEnum;
+
+static BOOL CALLBACK _wtk_monitor_enum(HMONITOR handle, HDC dc, LPRECT rect, LPARAM data) {
+    (void)dc; (void)rect;
+    _WtkMonitorEnum *enumeration = (_WtkMonitorEnum *)data;
+    if (enumeration->count == enumeration->cap)
+        return FALSE;
+
+    MONITORINFOEXA info = {0};
+    info.cbSize = sizeof info;
+    if (!GetMonitorInfoA(handle, (MONITORINFO *)&info))
+        return TRUE;
+
+    // Whole hertz only, and 0 or 1 stand for the hardware default
+    DEVMODEA mode = {.dmSize = sizeof mode};
+    int hz = EnumDisplaySettingsA(info.szDevice, ENUM_CURRENT_SETTINGS, &mode) && mode.dmDisplayFrequency > 1 ? (int)mode.dmDisplayFrequency : 0;
+
+    wtk_monitor_t *monitor = &enumeration->monitors[enumeration->count++];
+    *monitor = (wtk_monitor_t){
+        .id          = (uintptr_t)handle,
+        .x           = info.rcMonitor.left,
+        .y           = info.rcMonitor.top,
+        .w           = info.rcMonitor.right - info.rcMonitor.left,
+        .h           = info.rcMonitor.bottom - info.rcMonitor.top,
+        .refresh_mhz = hz * 1000,
+        .scale       = enumeration->scale,
+        .primary     = (info.dwFlags & MONITORINFOF_PRIMARY) != 0,
+    };
+    snprintf(monitor->name, sizeof monitor->name, "%s", info.szDevice);
+    return TRUE;
+}
 
-#elif defined(WTK_API_X11)
+static int _wtk_monitors_query(wtk_monitor_t *monitors, int cap) {
+    HDC screen = GetDC(NULL);
+    _WtkMonitorEnum enumeration = {monitors, cap, 0, GetDeviceCaps(screen, LOGPIXELSX) / 96.0f};
+    ReleaseDC(NULL, screen);
 
-static int _wtk_translate_key(int xkey, int state) {
-    xkey = XkbKeycodeToKeysym(_wtk.x11.display, xkey, 0, (state & ShiftMask) ? 1 : 0);
-    switch(xkey) {
-        case XK_BackSpace:  return WTK_KEY_BACKSPACE;
+    EnumDisplayMonitors(NULL, NULL, _wtk_monitor_enum, (LPARAM)&enumeration);
+    return enumeration.count;
+}
+
+static uintptr_t _wtk_window_monitor(wtk_window_t const *window) {
+    return (uintptr_t)MonitorFromWindow(window->window, MONITOR_DEFAULTTONEAREST);
+}
+
+static wtk_native_t _wtk_window_native(wtk_window_t const *window) {
+    return (wtk_native_t){.display = GetModuleHandle(NULL), .window = (uintptr_t)window->window};
+}
+
+// }}}
+// X11 {{{
+
+#elif defined(WTK_API_X11)
+
+static uint64_t _wtk_time_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static int _wtk_translate_keysym(int xkey) {
+    switch(xkey) {
+        case XK_BackSpace:  return WTK_KEY_BACKSPACE;
         case XK_Tab:        return WTK_KEY_TAB;
         case XK_Return:     return WTK_KEY_ENTER;
         case XK_Escape:     return WTK_KEY_ESCAPE;
@@ -422,8 +1452,18 @@ static int _wtk_translate_key(int xkey, int state) {
     }
 }
 
-static unsigned int _wtk_translate_mods(int state) {
-    unsigned int mods = 0;
+static void _wtk_update_keymap(void) {
+    for (int keycode = 0; keycode < 256; keycode++)
+        for (int shifted = 0; shifted < 2; shifted++)
+            _wtk.x11.keymap[keycode][shifted] = _wtk_translate_keysym(XkbKeycodeToKeysym(_wtk.x11.display, keycode, 0, shifted));
+}
+
+static int _wtk_translate_key(unsigned int keycode, unsigned int state) {
+    return _wtk.x11.keymap[keycode & 0xff][(state & ShiftMask) ? 1 : 0];
+}
+
+static int _wtk_translate_mods(unsigned int state) {
+    int mods = 0;
 
     if (state & ControlMask) mods |= WTK_MOD_CTRL;
     if (state & ShiftMask)   mods |= WTK_MOD_SHIFT;
@@ -434,143 +1474,690 @@ static unsigned int _wtk_translate_mods(int state) {
     return mods;
 }
 
-static void _wtk_post_event(wtk_window_t *window, int type, XEvent const *xevent) {
-    static wtk_event_t previousEvent = {0};
-    wtk_event_t event = {.type = type};
+// Server timestamps are wrapping 32-bit milliseconds. A local Xorg takes them from CLOCK_MONOTONIC, which pins down
+// when input happened better than when it was read; if the age doesn't look sane the clocks differ, so use the read time
+static uint64_t _wtk_server_time_ns(Time time) {
+    uint64_t received_ms = _wtk.x11.time / 1000000;
+    uint32_t age_ms = (uint32_t)received_ms - (uint32_t)time;
+    return age_ms < 10000 ? (received_ms - age_ms) * 1000000 : _wtk.x11.time;
+}
+
+static wtk_event_t _wtk_translate_event(wtk_window_t *window, int type, XEvent const *xevent) {
+    wtk_event_t event = {.type = type, .time_ns = _wtk.x11.time};
     if (type == WTK_EVENTTYPE_KEYDOWN || type == WTK_EVENTTYPE_KEYUP) {
-        event.key        = _wtk_translate_key(xevent->xkey.keycode, xevent->xkey.state);
-        event.mods       = xevent->xkey.state;
+        // Shift may change between press and release, and with detectable auto-repeat a held key sends only presses
+        unsigned keycode = xevent->xkey.keycode & 0xff;
+        if (!_wtk.x11.held[keycode].down)
+            _wtk.x11.held[keycode].key = _wtk_translate_key(keycode, xevent->xkey.state);
+        event.repeat = type == WTK_EVENTTYPE_KEYDOWN && _wtk.x11.held[keycode].down;
+        _wtk.x11.held[keycode].down = type == WTK_EVENTTYPE_KEYDOWN;
+
+        event.time_ns    = _wtk_server_time_ns(xevent->xkey.time);
+        event.key        = _wtk.x11.held[keycode].key;
+        event.mods       = _wtk_translate_mods(xevent->xkey.state);
         event.location.x = xevent->xkey.x;
         event.location.y = xevent->xkey.y;
+
+        // X reports the modifier state from before the event, so fold in the key itself
+        int mod = 0;
+        switch (event.key) {
+            case WTK_KEY_LSHIFT: case WTK_KEY_RSHIFT: mod = WTK_MOD_SHIFT; break;
+            case WTK_KEY_LCTRL:  case WTK_KEY_RCTRL:  mod = WTK_MOD_CTRL;  break;
+            case WTK_KEY_LALT:   case WTK_KEY_RALT:   mod = WTK_MOD_ALT;   break;
+            case WTK_KEY_LSUPER: case WTK_KEY_RSUPER: mod = WTK_MOD_SUPER; break;
+        }
+        event.mods = type == WTK_EVENTTYPE_KEYDOWN ? event.mods | mod : event.mods & ~mod;
     } else if (type == WTK_EVENTTYPE_MOUSEDOWN || type == WTK_EVENTTYPE_MOUSEUP) {
+        // X numbers middle before right and puts the wheel at 4-7, side buttons start at 8
         switch (xevent->xbutton.button) {
-            case Button4: event.delta.y =  1.0; break;
-            case Button5: event.delta.y = -1.0; break;
-            case 6:       event.delta.x =  1.0; break;
-            case 7:       event.delta.x = -1.0; break;
-            default:      event.button  = xevent->xbutton.button - Button1 - 4; break;
+            case Button1: event.button = WTK_BUTTON_1; break;
+            case Button2: event.button = WTK_BUTTON_3; break;
+            case Button3: event.button = WTK_BUTTON_2; break;
+            case Button4: event.type = WTK_EVENTTYPE_MOUSESCROLL; event.delta.y =  1; break;
+            case Button5: event.type = WTK_EVENTTYPE_MOUSESCROLL; event.delta.y = -1; break;
+            case 6:       event.type = WTK_EVENTTYPE_MOUSESCROLL; event.delta.x =  1; break;
+            case 7:       event.type = WTK_EVENTTYPE_MOUSESCROLL; event.delta.x = -1; break;
+            default:      event.button = WTK_BUTTON_4 + (int)xevent->xbutton.button - 8; break;
         }
-        event.mods       = xevent->xbutton.state;
+        event.time_ns    = _wtk_server_time_ns(xevent->xbutton.time);
+        event.mods       = _wtk_translate_mods(xevent->xbutton.state);
         event.location.x = xevent->xbutton.x;
         event.location.y = xevent->xbutton.y;
     } else if (type == WTK_EVENTTYPE_MOUSEMOTION) {
-        event.mods       = xevent->xmotion.state;
+        event.time_ns    = _wtk_server_time_ns(xevent->xmotion.time);
+        event.mods       = _wtk_translate_mods(xevent->xmotion.state);
         event.location.x = xevent->xmotion.x;
         event.location.y = xevent->xmotion.y;
+        event.delta.x    = event.location.x - window->mouse_x;
+        event.delta.y    = event.location.y - window->mouse_y;
+        window->mouse_x  = event.location.x;
+        window->mouse_y  = event.location.y;
+    } else if (type == WTK_EVENTTYPE_MOUSEENTER || type == WTK_EVENTTYPE_MOUSELEAVE) {
+        event.time_ns    = _wtk_server_time_ns(xevent->xcrossing.time);
+    }
+
+    return event;
+}
+
+static void _wtk_post_event(wtk_window_t *window, int type, XEvent const *xevent) {
+    wtk_event_t event = _wtk_translate_event(window, type, xevent);
+
+    // A wheel click is a press and a release; only the press scrolls
+    if (type == WTK_EVENTTYPE_MOUSEUP && event.type == WTK_EVENTTYPE_MOUSESCROLL)
+        return;
+    if ((type == WTK_EVENTTYPE_MOUSEDOWN || type == WTK_EVENTTYPE_MOUSEUP) && event.button > WTK_BUTTON_8)
+        return;
+
+    _wtk_dispatch_event(window, &event);
+}
+
+// Keys let go while another window has focus are never reported, so release whatever is held as focus leaves
+static void _wtk_release_keys(wtk_window_t *window) {
+    // A KEYUP callback may delete the window; the keys left are still let go of, just without telling anyone
+    uint32_t deleted = _wtk.deleted;
+    for (int keycode = 0; keycode < 256; keycode++) {
+        if (!_wtk.x11.held[keycode].down)
+            continue;
+
+        _wtk.x11.held[keycode].down = 0;
+        if (deleted != _wtk.deleted)
+            continue;
+
+        wtk_event_t event = {.type = WTK_EVENTTYPE_KEYUP, .key = _wtk.x11.held[keycode].key, .time_ns = _wtk.x11.time};
+        _wtk_dispatch_event(window, &event);
+    }
+}
+
+static void _wtk_post_configure(wtk_window_t *window) {
+    uint32_t deleted = _wtk.deleted;
+    if (window->moved) {
+        wtk_event_t event = {.type = WTK_EVENTTYPE_WINDOWMOVE, .location = {window->x, window->y}, .merged = window->moved - 1, .time_ns = _wtk.x11.time};
+        window->moved = 0;
+        _wtk_dispatch_event(window, &event);
+    }
+
+    // The callback may have deleted this window. If it deleted another one, the caller's walk gets back here
+    if (window->resized && deleted == _wtk.deleted) {
+        wtk_event_t event = {.type = WTK_EVENTTYPE_WINDOWRESIZE, .merged = window->resized - 1, .time_ns = _wtk.x11.time};
+        window->resized = 0;
+        _wtk_dispatch_event(window, &event);
+    }
+}
+
+static int _wtk_x11_error_handler(Display *display, XErrorEvent *event) {
+    if (display == _wtk.x11.display && _wtk.x11.trap.active && event->serial >= _wtk.x11.trap.serial) {
+        _wtk.x11.trap.error = event->error_code;
+        return 0;
     }
+    return _wtk.x11.error_handler ? _wtk.x11.error_handler(display, event) : 0;
+}
+
+// Catches the X errors of the requests made until _wtk_x11_untrap_errors instead of letting them end the process.
+// The handler stays installed and tells errors apart by serial, with the display locked so no other thread's
+// requests land in between
+static void _wtk_x11_trap_errors(void) {
+    XLockDisplay(_wtk.x11.display);
+    _wtk.x11.trap.serial = NextRequest(_wtk.x11.display);
+    _wtk.x11.trap.error = 0;
+    _wtk.x11.trap.active = 1;
+}
 
-    event.mods = _wtk_translate_mods(event.mods);
-    event.delta.x = event.location.x - previousEvent.location.x;
-    event.delta.y = event.location.y - previousEvent.location.y;
+// Returns the error code of the last trapped error, 0 if there was none
+static int _wtk_x11_untrap_errors(void) {
+    XSync(_wtk.x11.display, False);
+    _wtk.x11.trap.active = 0;
+    XUnlockDisplay(_wtk.x11.display);
+    return _wtk.x11.trap.error;
+}
 
-    window->desc.callback(window, &event);
-    previousEvent = event;
+// Undoes what _wtk_init had set up by the time something failed, leaving wtk_init free to be retried
+static int _wtk_x11_init_failed(int egl) {
+#if defined(_WTK_EGL)
+    if (egl)
+        _wtk_egl_quit();
+#else
+    (void)egl;
+#endif
+    XSetErrorHandler(_wtk.x11.error_handler);
+    XCloseDisplay(_wtk.x11.display);
+    _wtk.x11.display = NULL;
+    return 0;
 }
 
 int _wtk_init(void) {
+    // Shared contexts and wtk_post_empty_event may touch the display from other threads
+    XInitThreads();
+
     if (!(_wtk.x11.display = XOpenDisplay(NULL)))
         return 0;
 
-    _wtk.x11.context = XUniqueContext();
+    // Installed for good, swapping it around each request would race with other threads' Xlib calls
+    _wtk.x11.error_handler = XSetErrorHandler(_wtk_x11_error_handler);
+
+    int xkb_opcode, xkb_error, xkb_major = XkbMajorVersion, xkb_minor = XkbMinorVersion;
+    if (XkbQueryExtension(_wtk.x11.display, &xkb_opcode, &_wtk.x11.xkb_event, &xkb_error, &xkb_major, &xkb_minor)) {
+        XkbSelectEvents(_wtk.x11.display, XkbUseCoreKbd, XkbMapNotifyMask, XkbMapNotifyMask);
+
+        // Held keys repeat as presses alone instead of release/press pairs that look like real input
+        Bool supported;
+        XkbSetDetectableAutoRepeat(_wtk.x11.display, True, &supported);
+    } else
+        _wtk.x11.xkb_event = -1;
+
+    if ((_wtk.x11.shm = XShmQueryExtension(_wtk.x11.display)))
+        _wtk.x11.shm_completion = XShmGetEventBase(_wtk.x11.display) + ShmCompletion;
+
+    _wtk_update_keymap();
+
     _wtk.x11.screen  = DefaultScreen(_wtk.x11.display);
     _wtk.x11.root    = RootWindow(_wtk.x11.display, _wtk.x11.screen);
-    _wtk.x11.visual  = DefaultVisual(_wtk.x11.display, _wtk.x11.screen);
-    _wtk.x11.depth   = DefaultDepth(_wtk.x11.display, _wtk.x11.screen);
 
-    if (!(_wtk.x11.colormap = XCreateColormap(_wtk.x11.display, _wtk.x11.root, _wtk.x11.visual, AllocNone)))
-        return 0;
+    // 1.3 reads the current configuration without making the server probe outputs
+    int randr_error, randr_major = 0, randr_minor = 0;
+    if (XRRQueryExtension(_wtk.x11.display, &_wtk.x11.randr_event, &randr_error) && XRRQueryVersion(_wtk.x11.display, &randr_major, &randr_minor) &&
+        (randr_major > 1 || randr_minor >= 3))
+        XRRSelectInput(_wtk.x11.display, _wtk.x11.root, RRScreenChangeNotifyMask | RRCrtcChangeNotifyMask | RROutputChangeNotifyMask);
+    else
+        _wtk.x11.randr_event = -1;
 
-    if (!(_wtk.x11.wm_delwin = XInternAtom(_wtk.x11.display, "WM_DELETE_WINDOW", 0)))
-        return 0;
+    // Intern every atom in one round trip
+    struct { char *name; Atom *atom; } atoms[] = {
+        {"WM_DELETE_WINDOW", &_wtk.x11.wm_delwin},
+        {"_WTK_INPUT_STOP",  &_wtk.x11.input.stop},
+    };
+
+    char *atom_names[sizeof atoms / sizeof *atoms];
+    Atom atom_values[sizeof atoms / sizeof *atoms];
+    for (size_t i = 0; i < sizeof atoms / sizeof *atoms; i++)
+        atom_names[i] = atoms[i].name;
+
+    if (!XInternAtoms(_wtk.x11.display, atom_names, sizeof atoms / sizeof *atoms, 0, atom_values))
+        return _wtk_x11_init_failed(0);
+
+    for (size_t i = 0; i < sizeof atoms / sizeof *atoms; i++)
+        *atoms[i].atom = atom_values[i];
 
+#if defined(_WTK_EGL)
+    PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+
+    EGLDisplay display = EGL_NO_DISPLAY;
+    if (get_platform_display)
+        display = get_platform_display(EGL_PLATFORM_X11_KHR, _wtk.x11.display, NULL);
+    if (display == EGL_NO_DISPLAY)
+        display = eglGetDisplay((EGLNativeDisplayType)_wtk.x11.display);
+
+    if (!_wtk_egl_init(display))
+        return _wtk_x11_init_failed(0);
+#else
     _wtk.x11.glx_create_ctx_attribs = (_WtkGlXCreateContextAttribsARBProc *)glXGetProcAddressARB((GLubyte const *)"glXCreateContextAttribsARB");
 
+    char const *glx_extensions = glXQueryExtensionsString(_wtk.x11.display, _wtk.x11.screen);
+    if (_wtk_has_extension(glx_extensions, "GLX_EXT_swap_control"))
+        _wtk.x11.glx_swap_interval_ext = (_WtkGlXSwapIntervalEXTProc *)glXGetProcAddressARB((GLubyte const *)"glXSwapIntervalEXT");
+    if (_wtk_has_extension(glx_extensions, "GLX_MESA_swap_control")) {
+        _wtk.x11.glx_swap_interval_mesa = (_WtkGlXSwapIntervalMESAProc *)glXGetProcAddressARB((GLubyte const *)"glXSwapIntervalMESA");
+        _wtk.x11.glx_get_swap_interval_mesa = (_WtkGlXGetSwapIntervalMESAProc *)glXGetProcAddressARB((GLubyte const *)"glXGetSwapIntervalMESA");
+    }
+    _wtk.x11.glx_swap_control_tear = _wtk_has_extension(glx_extensions, "GLX_EXT_swap_control_tear");
+    _wtk.x11.glx_buffer_age = _wtk_has_extension(glx_extensions, "GLX_EXT_buffer_age");
+    _wtk.x11.glx_no_error = _wtk_has_extension(glx_extensions, "GLX_ARB_create_context_no_error");
+    _wtk.x11.glx_srgb = _wtk_has_extension(glx_extensions, "GLX_ARB_framebuffer_sRGB") || _wtk_has_extension(glx_extensions, "GLX_EXT_framebuffer_sRGB");
+
+    // Completion events carry each swap's own present time, without a round trip per frame
+    int glx_error, glx_event;
+    if (_wtk_has_extension(glx_extensions, "GLX_INTEL_swap_event") && glXQueryExtension(_wtk.x11.display, &glx_error, &glx_event))
+        _wtk.x11.glx_swap_complete = glx_event + GLX_BufferSwapComplete;
+#endif
+
+    // Self-pipe so wtk_post_empty_event() can wake a thread blocked in poll()
+    if (pipe(_wtk.x11.wakeup))
+        return _wtk_x11_init_failed(1);
+
+    for (int i = 0; i < 2; i++) {
+        fcntl(_wtk.x11.wakeup[i], F_SETFL, fcntl(_wtk.x11.wakeup[i], F_GETFL) | O_NONBLOCK);
+        fcntl(_wtk.x11.wakeup[i], F_SETFD, FD_CLOEXEC);
+    }
+
     return 1;
 }
 
+static void _wtk_input_thread_stop(void);
+
 void _wtk_quit(void) {
-    XFreeColormap(_wtk.x11.display, _wtk.x11.colormap);
+    _wtk_input_thread_stop();
+    close(_wtk.x11.wakeup[0]);
+    close(_wtk.x11.wakeup[1]);
+    for (int i = 0; i < _wtk.x11.config_count; i++)
+        XFreeColormap(_wtk.x11.display, _wtk.x11.configs[i].colormap);
+    _wtk.x11.config_count = 0;
+#if defined(_WTK_EGL)
+    _wtk_egl_quit();
+#endif
+    XSetErrorHandler(_wtk.x11.error_handler);
     XCloseDisplay(_wtk.x11.display);
 }
 
+// Past _WTK_X11_CONFIGS distinct requests the config is chosen into uncached instead, and the caller owns its colormap
+static _WtkX11Config *_wtk_x11_choose_config(wtk_gl_desc_t *gl, _WtkX11Config *uncached) {
+#if defined(_WTK_EGL)
+    if (!_wtk.egl.colorspace)
+        gl->srgb = 0;
+#else
+    if (!_wtk.x11.glx_srgb)
+        gl->srgb = 0;
+#endif
+
+    // Choosing a config costs a round trip, so each distinct request is only resolved once
+    int key[4] = {gl->samples, gl->srgb, gl->depth_bits, gl->stencil_bits};
+    for (int i = 0; i < _wtk.x11.config_count; i++) {
+        if (!memcmp(_wtk.x11.configs[i].key, key, sizeof key)) {
+            gl->samples = _wtk.x11.configs[i].samples;
+            gl->srgb = _wtk.x11.configs[i].srgb;
+            return &_wtk.x11.configs[i];
+        }
+    }
+
+#if defined(_WTK_EGL)
+    // Shared contexts borrow a pbuffer when the display can't make them current without a surface
+    EGLint surface_type = EGL_WINDOW_BIT | (_wtk.egl.surfaceless ? 0 : EGL_PBUFFER_BIT);
+
+    EGLConfig eglconfig = NULL;
+    for (;;) {
+        EGLint attribs[] = {
+            EGL_SURFACE_TYPE,       surface_type,
+            EGL_RENDERABLE_TYPE,    EGL_OPENGL_BIT,
+            EGL_RED_SIZE,           8,
+            EGL_GREEN_SIZE,         8,
+            EGL_BLUE_SIZE,          8,
+            EGL_DEPTH_SIZE,         gl->depth_bits,
+            EGL_STENCIL_SIZE,       gl->stencil_bits,
+            EGL_SAMPLE_BUFFERS,     gl->samples ? 1 : 0,
+            EGL_SAMPLES,            gl->samples,
+            EGL_NONE
+        };
+
+        EGLConfig configs[64];
+        EGLint count = 0;
+        if (!eglChooseConfig(_wtk.egl.display, attribs, configs, 64, &count))
+            count = 0;
+
+        // Same as GLX below, and skip configs with no X visual to put them on
+        for (int i = 0; i < count && !eglconfig; i++) {
+            EGLint depth = 0, stencil = 0, visual = 0;
+            eglGetConfigAttrib(_wtk.egl.display, configs[i], EGL_DEPTH_SIZE, &depth);
+            eglGetConfigAttrib(_wtk.egl.display, configs[i], EGL_STENCIL_SIZE, &stencil);
+            eglGetConfigAttrib(_wtk.egl.display, configs[i], EGL_NATIVE_VISUAL_ID, &visual);
+            if (visual && (gl->depth_bits || !depth) && (gl->stencil_bits || !stencil))
+                eglconfig = configs[i];
+        }
+
+        for (int i = 0; i < count && !eglconfig; i++) {
+            EGLint visual = 0;
+            eglGetConfigAttrib(_wtk.egl.display, configs[i], EGL_NATIVE_VISUAL_ID, &visual);
+            if (visual)
+                eglconfig = configs[i];
+        }
+
+        if (eglconfig || !_wtk_relax_pixel_format(gl))
+            break;
+    }
+
+    XVisualInfo *vi = NULL;
+    if (eglconfig) {
+        EGLint visual = 0;
+        eglGetConfigAttrib(_wtk.egl.display, eglconfig, EGL_NATIVE_VISUAL_ID, &visual);
+
+        int count = 0;
+        XVisualInfo template = {.visualid = (VisualID)visual};
+        vi = XGetVisualInfo(_wtk.x11.display, VisualIDMask, &template, &count);
+    }
+#else
+    GLXFBConfig fbconfig = NULL;
+    for (;;) {
+        GLint attribs[32], n = 0;
+        attribs[n++] = GLX_X_RENDERABLE;    attribs[n++] = True;
+        attribs[n++] = GLX_DRAWABLE_TYPE;   attribs[n++] = GLX_WINDOW_BIT;
+        attribs[n++] = GLX_RENDER_TYPE;     attribs[n++] = GLX_RGBA_BIT;
+        attribs[n++] = GLX_DOUBLEBUFFER;    attribs[n++] = True;
+        attribs[n++] = GLX_RED_SIZE;        attribs[n++] = 8;
+        attribs[n++] = GLX_GREEN_SIZE;      attribs[n++] = 8;
+        attribs[n++] = GLX_BLUE_SIZE;       attribs[n++] = 8;
+        attribs[n++] = GLX_DEPTH_SIZE;      attribs[n++] = gl->depth_bits;
+        attribs[n++] = GLX_STENCIL_SIZE;    attribs[n++] = gl->stencil_bits;
+        if (gl->samples) {
+            attribs[n++] = GLX_SAMPLE_BUFFERS;  attribs[n++] = 1;
+            attribs[n++] = GLX_SAMPLES;         attribs[n++] = gl->samples;
+        }
+        if (gl->srgb) {
+            attribs[n++] = GLX_FRAMEBUFFER_SRGB_CAPABLE_ARB; attribs[n++] = True;
+        }
+        attribs[n++] = None;
+
+        int count = 0;
+        GLXFBConfig *fbc = glXChooseFBConfig(_wtk.x11.display, _wtk.x11.screen, attribs, &count);
+
+        // Sizes are minimums, so when no depth or stencil buffer was asked for look for one that really has none
+        for (int i = 0; fbc && i < count && !fbconfig; i++) {
+            int depth = 0, stencil = 0;
+            glXGetFBConfigAttrib(_wtk.x11.display, fbc[i], GLX_DEPTH_SIZE, &depth);
+            glXGetFBConfigAttrib(_wtk.x11.display, fbc[i], GLX_STENCIL_SIZE, &stencil);
+            if ((gl->depth_bits || !depth) && (gl->stencil_bits || !stencil))
+                fbconfig = fbc[i];
+        }
+
+        if (fbc && count && !fbconfig)
+            fbconfig = fbc[0];
+        if (fbc)
+            XFree(fbc);
+
+        if (fbconfig || !_wtk_relax_pixel_format(gl))
+            break;
+    }
+
+    XVisualInfo *vi = fbconfig ? glXGetVisualFromFBConfig(_wtk.x11.display, fbconfig) : NULL;
+#endif
+    if (!vi)
+        return NULL;
+
+    _WtkX11Config *config = _wtk.x11.config_count < _WTK_X11_CONFIGS ? &_wtk.x11.configs[_wtk.x11.config_count++] : uncached;
+    *config = (_WtkX11Config){
+        .key      = {key[0], key[1], key[2], key[3]},
+        .samples  = gl->samples,
+        .srgb     = gl->srgb,
+#if defined(_WTK_EGL)
+        .config   = eglconfig,
+#else
+        .fbconfig = fbconfig,
+#endif
+        .visual   = vi->visual,
+        .depth    = vi->depth,
+        .colormap = XCreateColormap(_wtk.x11.display, _wtk.x11.root, vi->visual, AllocNone),
+    };
+
+    XFree(vi);
+    return config;
+}
+
+#if !defined(_WTK_EGL)
+static GLXContext _wtk_glx_create_context(GLXFBConfig fbconfig, GLXContext share, wtk_gl_desc_t *gl) {
+    if (!_wtk.x11.glx_create_ctx_attribs)
+        gl->major = gl->minor = 0;
+
+    for (;;) {
+        // Unsupported attributes come back as X errors, which would otherwise end the process
+        _wtk_x11_trap_errors();
+
+        GLXContext context;
+        if (!gl->major) {
+            context = glXCreateNewContext(_wtk.x11.display, fbconfig, GLX_RGBA_TYPE, share, 1);
+        } else {
+            GLint attribs[16], n = 0;
+            attribs[n++] = GLX_CONTEXT_MAJOR_VERSION_ARB;   attribs[n++] = gl->major;
+            attribs[n++] = GLX_CONTEXT_MINOR_VERSION_ARB;   attribs[n++] = gl->minor;
+            if (gl->major * 10 + gl->minor >= 32) {
+                attribs[n++] = GLX_CONTEXT_PROFILE_MASK_ARB;
+                attribs[n++] = gl->profile == WTK_GL_PROFILE_COMPAT ? GLX_CONTEXT_COMPATIBILITY_PROFILE_BIT_ARB : GLX_CONTEXT_CORE_PROFILE_BIT_ARB;
+            }
+            if (gl->debug) {
+                attribs[n++] = GLX_CONTEXT_FLAGS_ARB;       attribs[n++] = GLX_CONTEXT_DEBUG_BIT_ARB;
+            }
+            if (gl->no_error && _wtk.x11.glx_no_error) {
+                attribs[n++] = GLX_CONTEXT_OPENGL_NO_ERROR_ARB; attribs[n++] = True;
+            }
+            attribs[n++] = None;
+
+            context = _wtk.x11.glx_create_ctx_attribs(_wtk.x11.display, fbconfig, share, 1, attribs);
+        }
+
+        if (_wtk_x11_untrap_errors() && context) {
+            glXDestroyContext(_wtk.x11.display, context);
+            context = NULL;
+        }
+
+        if (context || !_wtk_relax_context(gl))
+            return context;
+    }
+}
+#endif
+
 int _wtk_window_create(wtk_window_t *window) {
     XSetWindowAttributes swa = {
         .event_mask = StructureNotifyMask|PointerMotionMask|ButtonPressMask|ButtonReleaseMask|KeyPressMask|KeyReleaseMask|EnterWindowMask|LeaveWindowMask|FocusChangeMask|ExposureMask,
-        .colormap = _wtk.x11.colormap
     };
+    unsigned long mask = CWEventMask;
+
+    // The visual is fixed at creation, so even a lazy context picks its config now. Without GL the
+    // default visual does, which is what Vulkan and XPutImage want anyway
+    if (window->desc.context == WTK_CONTEXT_NONE) {
+        window->visual = DefaultVisual(_wtk.x11.display, _wtk.x11.screen);
+        window->depth = DefaultDepth(_wtk.x11.display, _wtk.x11.screen);
+    } else {
+        _WtkX11Config uncached;
+        _WtkX11Config *config = _wtk_x11_choose_config(&window->desc.gl, &uncached);
+        if (!config) return 0;
+        if (config == &uncached)
+            window->colormap = uncached.colormap;
+
+        window->visual = config->visual;
+        window->depth = config->depth;
+#if defined(_WTK_EGL)
+        window->config = config->config;
+#else
+        window->fbconfig = config->fbconfig;
+#endif
+        swa.colormap = config->colormap;
+        mask |= CWColormap;
+    }
 
     window->window = XCreateWindow(
         _wtk.x11.display, _wtk.x11.root,
         window->x, window->y, window->desc.w, window->desc.h,
-        0, _wtk.x11.depth, InputOutput,
-        _wtk.x11.visual, CWColormap | CWEventMask, &swa
+        0, window->depth, InputOutput,
+        window->visual, mask, &swa
     );
     if (!window->window) return 0;
 
     if (!XSetWMProtocols(_wtk.x11.display, window->window, &_wtk.x11.wm_delwin, 1))
         return 0;
 
-    GLint vis_attribs[] = {
-        GLX_RENDER_TYPE,  GLX_RGBA_BIT,
-        GLX_DOUBLEBUFFER, 1,
-        None
-    };
-
-    int fbcount = 0;
-    GLXFBConfig *fbc = glXChooseFBConfig(_wtk.x11.display, _wtk.x11.screen, vis_attribs, &fbcount);
-    if (!fbc || !fbcount) return 0;
-
-    GLint ctx_attribs[] = {
-        GLX_CONTEXT_MAJOR_VERSION_ARB, 4,
-        GLX_CONTEXT_MINOR_VERSION_ARB, 6,
-        GLX_CONTEXT_PROFILE_MASK_ARB, GLX_CONTEXT_CORE_PROFILE_BIT_ARB,
-        None
-    };
-
-    if (_wtk.x11.glx_create_ctx_attribs)
-        window->context = _wtk.x11.glx_create_ctx_attribs(_wtk.x11.display, fbc[0], NULL, 1, ctx_attribs);
-    else
-        window->context = glXCreateNewContext(_wtk.x11.display, fbc[0], GLX_RGBA_TYPE, NULL, 1);
-
-    XSaveContext(_wtk.x11.display, window->window, _wtk.x11.context, (XPointer)window);
     XMapWindow(_wtk.x11.display, window->window);
     XFlush(_wtk.x11.display);
     return 1;
 }
 
+static int _wtk_window_create_context(wtk_window_t *window) {
+#if defined(_WTK_EGL)
+    EGLint attribs[4];
+    window->surface = eglCreateWindowSurface(_wtk.egl.display, window->config, (EGLNativeWindowType)window->window, _wtk_egl_surface_attribs(window, attribs, 0));
+    if (window->surface == EGL_NO_SURFACE)
+        return 0;
+
+    window->context = _wtk_egl_create_context(window->config, EGL_NO_CONTEXT, &window->desc.gl);
+    return window->context != EGL_NO_CONTEXT;
+#else
+    window->context = _wtk_glx_create_context(window->fbconfig, NULL, &window->desc.gl);
+    return window->context != NULL;
+#endif
+}
+
+#if !defined(_WTK_EGL)
 void _wtk_window_make_current(wtk_window_t *window) {
     glXMakeContextCurrent(_wtk.x11.display, window->window, window->window, window->context);
 }
 
-void _wtk_window_swap_buffers(wtk_window_t *window) {
+void _wtk_window_swap_buffers(wtk_window_t *window, wtk_rect_t const *rects, int n) {
+    // GLX has no damage extension, the hint is dropped
+    (void)rects; (void)n;
+    if (_wtk.x11.glx_swap_complete && !window->swap_events) {
+        glXSelectEvent(_wtk.x11.display, window->window, GLX_BUFFER_SWAP_COMPLETE_INTEL_MASK);
+        window->swap_events = 1;
+    }
     glXSwapBuffers(_wtk.x11.display, window->window);
 }
 
+static int _wtk_window_buffer_age(wtk_window_t const *window) {
+    // Querying a drawable that isn't current is an error
+    unsigned age = 0;
+    if (_wtk.x11.glx_buffer_age && _wtk_current == window)
+        glXQueryDrawable(_wtk.x11.display, window->window, GLX_BACK_BUFFER_AGE_EXT, &age);
+    return (int)age;
+}
+
+// Only the first make current creates the GLX drawable the EXT query needs, and MESA's getter reads the current
+// context's. The window is only current for the call, whatever was current before is put back
+static int _wtk_window_query_swap_interval(wtk_window_t *window) {
+    GLXContext context = glXGetCurrentContext();
+    GLXDrawable draw = glXGetCurrentDrawable(), read = glXGetCurrentReadDrawable();
+    _wtk_window_make_current(window);
+
+    int interval = 0;
+    if (_wtk.x11.glx_swap_interval_ext) {
+        unsigned int value = 0, tear = 0;
+        glXQueryDrawable(_wtk.x11.display, window->window, GLX_SWAP_INTERVAL_EXT, &value);
+        if (_wtk.x11.glx_swap_control_tear)
+            glXQueryDrawable(_wtk.x11.display, window->window, GLX_LATE_SWAPS_TEAR_EXT, &tear);
+        interval = tear ? -(int)value : (int)value;
+    } else if (_wtk.x11.glx_get_swap_interval_mesa) {
+        interval = _wtk.x11.glx_get_swap_interval_mesa();
+    }
+
+    glXMakeContextCurrent(_wtk.x11.display, draw, read, context);
+    return interval;
+}
+
+static int _wtk_window_set_swap_interval(wtk_window_t *window, int interval) {
+    if (interval < 0 && !_wtk.x11.glx_swap_control_tear)
+        interval = -interval;
+
+    // Called once the context exists, so the GLX drawable does too
+    if (_wtk.x11.glx_swap_interval_ext) {
+        _wtk.x11.glx_swap_interval_ext(_wtk.x11.display, window->window, interval);
+        return _wtk_window_query_swap_interval(window);
+    }
+
+    // GLX_MESA_swap_control has no adaptive mode and applies to the current context's drawable
+    if (_wtk.x11.glx_swap_interval_mesa) {
+        interval = interval < 0 ? -interval : interval;
+        GLXContext context = glXGetCurrentContext();
+        GLXDrawable draw = glXGetCurrentDrawable(), read = glXGetCurrentReadDrawable();
+        _wtk_window_make_current(window);
+        int failed = _wtk.x11.glx_swap_interval_mesa((unsigned int)interval);
+        glXMakeContextCurrent(_wtk.x11.display, draw, read, context);
+        return failed ? window->swap_interval : interval;
+    }
+
+    return window->swap_interval;
+}
+#endif
+
+// Pulls from the input thread's ring when it runs, otherwise straight from Xlib
+static int _wtk_next_xevent(XEvent *event, int peek) {
+    if (_wtk.x11.input.ring) {
+        unsigned tail = _wtk.x11.input.tail;
+        if (tail == __atomic_load_n(&_wtk.x11.input.head, __ATOMIC_ACQUIRE))
+            return 0;
+
+        *event = _wtk.x11.input.ring[tail & _wtk.x11.input.mask].event;
+        if (!peek) {
+            _wtk.x11.time = _wtk.x11.input.ring[tail & _wtk.x11.input.mask].time;
+            __atomic_store_n(&_wtk.x11.input.tail, tail + 1, __ATOMIC_RELEASE);
+        }
+        return 1;
+    }
+
+    if (!XPending(_wtk.x11.display))
+        return 0;
+
+    if (peek)
+        XPeekEvent(_wtk.x11.display, event);
+    else {
+        XNextEvent(_wtk.x11.display, event);
+        _wtk.x11.time = _wtk_time_ns();
+    }
+    return 1;
+}
+
 void _wtk_poll_events(void) {
     wtk_window_t *window;
     XEvent event;
 
-    while (XPending(_wtk.x11.display)) {
-        XNextEvent(_wtk.x11.display, &event);
-        if (XFindContext(_wtk.x11.display, event.xany.window, _wtk.x11.context, (XPointer *)&window))
+    // XPending flushes the output buffer on its way, but with the input thread nothing calls it and requests from
+    // this thread would sit there while the other one blocks in XNextEvent
+    if (_wtk.x11.input.ring)
+        XFlush(_wtk.x11.display);
+
+    while (_wtk_next_xevent(&event, 0)) {
+
+        // Keyboard mapping changes aren't tied to a window; rebuild the keycode table and move on
+        if (event.type == MappingNotify) {
+            XRefreshKeyboardMapping(&event.xmapping);
+            if (event.xmapping.request != MappingPointer)
+                _wtk_update_keymap();
+            continue;
+        } else if (event.type == _wtk.x11.xkb_event) {
+            if (((XkbEvent *)&event)->any.xkb_type == XkbMapNotify) {
+                XkbRefreshKeyboardMapping(&((XkbEvent *)&event)->map);
+                _wtk_update_keymap();
+            }
+            continue;
+        } else if (_wtk.x11.randr_event >= 0 && (event.type == _wtk.x11.randr_event + RRScreenChangeNotify || event.type == _wtk.x11.randr_event + RRNotify)) {
+            XRRUpdateConfiguration(&event);
+            _wtk_monitors_changed();
+            continue;
+        }
+
+        if (!(window = _wtk_window_find(event.xany.window)))
+            continue;
+
+#if !defined(_WTK_EGL)
+        if (_wtk.x11.glx_swap_complete && event.type == _wtk.x11.glx_swap_complete) {
+            // UST is in microseconds on CLOCK_MONOTONIC for every Mesa and NVIDIA driver
+            GLXBufferSwapComplete const *swap = (GLXBufferSwapComplete const *)&event;
+            _wtk_frame_presented(window, (uint64_t)swap->sbc, (uint64_t)swap->ust * 1000, (uint64_t)swap->msc);
+            continue;
+        }
+#endif
+
+        if (_wtk.x11.shm && event.type == _wtk.x11.shm_completion) {
+            for (int i = 0; i < 2; i++)
+                if (window->ximage.shm[i].shmseg == ((XShmCompletionEvent *)&event)->shmseg)
+                    window->ximage.pending[i] = 0;
             continue;
+        }
 
         switch (event.type) {
             case KeyPress:      _wtk_post_event(window, WTK_EVENTTYPE_KEYDOWN, &event);        break;
             case KeyRelease:    _wtk_post_event(window, WTK_EVENTTYPE_KEYUP, &event);          break;
             case ButtonPress:   _wtk_post_event(window, WTK_EVENTTYPE_MOUSEDOWN, &event);      break;
             case ButtonRelease: _wtk_post_event(window, WTK_EVENTTYPE_MOUSEUP, &event);        break;
-            case MotionNotify:  _wtk_post_event(window, WTK_EVENTTYPE_MOUSEMOTION, &event);    break;
             case EnterNotify:   _wtk_post_event(window, WTK_EVENTTYPE_MOUSEENTER, &event);     break;
             case LeaveNotify:   _wtk_post_event(window, WTK_EVENTTYPE_MOUSELEAVE, &event);     break;
             case MapNotify:     _wtk_post_event(window, WTK_EVENTTYPE_WINDOWFOCUSIN, &event);  break;
             case UnmapNotify:   _wtk_post_event(window, WTK_EVENTTYPE_WINDOWFOCUSOUT, &event); break;
+            case FocusOut:      if (event.xfocus.detail != NotifyInferior) _wtk_release_keys(window);  break;
+            case Expose:        _wtk_window_damage(window, (wtk_rect_t){event.xexpose.x, event.xexpose.y, event.xexpose.width, event.xexpose.height}); break;
+            case MotionNotify: {
+                // Fold the run of motion events for this window into the last one; deltas accumulate
+                int merged = 0;
+                for (XEvent next; window->desc.coalesce && _wtk_next_xevent(&next, 1); merged++) {
+                    if (next.type != MotionNotify || next.xmotion.window != event.xmotion.window)
+                        break;
+                    _wtk_next_xevent(&event, 0);
+                }
+
+                wtk_event_t ev = _wtk_translate_event(window, WTK_EVENTTYPE_MOUSEMOTION, &event);
+                ev.merged = merged;
+                _wtk_dispatch_event(window, &ev);
+            } break;
             case ConfigureNotify: {
+                window->moved   += event.xconfigure.x != window->x || event.xconfigure.y != window->y;
+                window->resized += event.xconfigure.width != window->desc.w || event.xconfigure.height != window->desc.h;
                 window->x = event.xconfigure.x;
                 window->y = event.xconfigure.y;
                 window->desc.w = event.xconfigure.width;
                 window->desc.h = event.xconfigure.height;
-                _wtk_post_event(window, WTK_EVENTTYPE_WINDOWRESIZE, &event);
+                if (!window->desc.coalesce)
+                    _wtk_post_configure(window);
             } break;
             case ClientMessage: {
                 if ((Atom)event.xclient.data.l[0] == _wtk.x11.wm_delwin) {
@@ -580,107 +2167,1816 @@ void _wtk_poll_events(void) {
             } break;
         }
     }
-}
 
-void _wtk_window_delete(wtk_window_t *window) {
-    glXDestroyContext(_wtk.x11.display, window->context);
-    XDestroyWindow(_wtk.x11.display, window->window);
+    // Coalesced configure events are reported once the queue is drained. A callback deleting windows restarts the
+    // walk, which only finds what's still pending
+    for (wtk_window_t *it = _wtk.window_list; it;) {
+        uint32_t deleted = _wtk.deleted;
+        _wtk_post_configure(it);
+        it = deleted == _wtk.deleted ? it->next : _wtk.window_list;
+    }
 }
 
-void _wtk_window_set_pos(wtk_window_t *window, int x, int y) {
-    XMoveWindow(_wtk.x11.display, window->window, x, y);
-}
+static void _wtk_wait_events(int64_t timeout) {
+    // Events may already sit in Xlib's queue or the input ring, in which case the fd won't become readable
+    int threaded = _wtk.x11.input.ring != NULL;
+    int pending = threaded ? _wtk.x11.input.tail != __atomic_load_n(&_wtk.x11.input.head, __ATOMIC_ACQUIRE) : XPending(_wtk.x11.display);
+
+    if (!pending) {
+        // With an input thread the display fd belongs to it, and it signals through the wakeup pipe instead.
+        // Whatever this thread asked of the server has to go out before it sleeps
+        if (threaded)
+            XFlush(_wtk.x11.display);
+
+        struct pollfd fds[] = {
+            {.fd = _wtk.x11.wakeup[0],                 .events = POLLIN},
+            {.fd = ConnectionNumber(_wtk.x11.display), .events = POLLIN},
+        };
+
+        int ms = timeout < 0 ? -1 : timeout / 1000000 > 0x7fffffff ? 0x7fffffff : (int)((timeout + 999999) / 1000000);
+        while (poll(fds, threaded ? 1 : 2, ms) < 0 && errno == EINTR)
+            ;
+
+        if (fds[0].revents & POLLIN)
+            for (char buf[64]; read(_wtk.x11.wakeup[0], buf, sizeof buf) > 0;)
+                ;
+    }
 
-void _wtk_window_set_size(wtk_window_t *window, int w, int h) {
-    XResizeWindow(_wtk.x11.display, window->window, (unsigned int)w, (unsigned int)h);
+    _wtk_poll_events();
 }
 
-void _wtk_window_set_title(wtk_window_t *window, char const *title) {
-    XStoreName(_wtk.x11.display, window->window, title);
+static void _wtk_post_empty_event(void) {
+    while (write(_wtk.x11.wakeup[1], "", 1) < 0 && errno == EINTR)
+        ;
 }
 
-// }}}
-// Cocoa {{{
+static void *_wtk_input_thread(void *arg) {
+    (void)arg;
 
-#elif defined(WTK_API_COCOA)
+    for (XEvent event;;) {
+        // Xlib hands events read by other threads' round trips to a blocked XNextEvent, so this never misses any
+        XNextEvent(_wtk.x11.display, &event);
+        if (event.type == ClientMessage && event.xclient.window == _wtk.x11.input.helper && event.xclient.message_type == _wtk.x11.input.stop)
+            break;
+
+        uint64_t time = _wtk_time_ns();
+        unsigned head = _wtk.x11.input.head;
+        if (head - __atomic_load_n(&_wtk.x11.input.tail, __ATOMIC_ACQUIRE) > _wtk.x11.input.mask) {
+            // A full ring may not have been announced yet, a burst Xlib had already read counts as one. Without this
+            // the poller would sleep on the pipe while this thread waits for it to make room
+            _wtk_post_empty_event();
+            while (head - __atomic_load_n(&_wtk.x11.input.tail, __ATOMIC_ACQUIRE) > _wtk.x11.input.mask)
+                nanosleep(&(struct timespec){.tv_nsec = 100000}, NULL);
+        }
 
-static void _wtk_post_event(wtk_window_t *window, int type, NSEvent *event) {
-    wtk_event_t ev = {
-        .type       = type,
-        .mods       = (int)[event modifierFlags],
-        .location   = {(int)[event locationInWindow].x, (int)[event locationInWindow].y},
-        .delta      = {(int)[event deltaX], (int)[event deltaY]}
-    };
+        _wtk.x11.input.ring[head & _wtk.x11.input.mask].event = event;
+        _wtk.x11.input.ring[head & _wtk.x11.input.mask].time = time;
+        __atomic_store_n(&_wtk.x11.input.head, head + 1, __ATOMIC_RELEASE);
 
-    if (type == WTK_EVENTTYPE_KEYDOWN || type == WTK_EVENTTYPE_KEYUP)
-        ev.key = [event keyCode];
-    else if (type == WTK_EVENTTYPE_MOUSEDOWN || type == WTK_EVENTTYPE_MOUSEUP)
-        ev.button = [event buttonNumber];
+        // One wakeup per burst rather than per event
+        if (!XEventsQueued(_wtk.x11.display, QueuedAlready))
+            _wtk_post_empty_event();
+    }
 
-    window->desc.callback(window, &ev);
+    __atomic_store_n(&_wtk.x11.input.done, 1, __ATOMIC_RELEASE);
+    return NULL;
 }
 
-static float _wtk_flip_y(float y) {
-    return CGDisplayBounds(CGMainDisplayID()).size.height - y - 1;
-}
+static int _wtk_input_thread_start(void) {
+    if (_wtk.x11.input.ring)
+        return 1;
 
-@implementation _WtkCocoaApp
-- (void)applicationWillFinishLaunching:(NSNotification *)notification {
-    id menubar = [[NSMenu new] autorelease];
-    id appMenuItem = [[NSMenuItem new] autorelease];
-    id appMenu = [[NSMenu new] autorelease];
-    id appName = [[NSProcessInfo processInfo] processName];
-    id quitTitle = [@"Quit " stringByAppendingString:appName];
-    id quitMenuItem = [[[NSMenuItem alloc] initWithTitle:quitTitle action:@selector(terminate:) keyEquivalent:@"q"] autorelease];
+    unsigned size = 1024;
+    if (!(_wtk.x11.input.ring = calloc(size, sizeof *_wtk.x11.input.ring)))
+        return 0;
 
-    [menubar addItem:appMenuItem];
-    [appMenu addItem:quitMenuItem];
-    [appMenuItem setSubmenu:appMenu];
-    [NSApp setMainMenu:menubar];
-}
+    _wtk.x11.input.mask = size - 1;
+    _wtk.x11.input.head = _wtk.x11.input.tail = 0;
+    _wtk.x11.input.done = 0;
+    _wtk.x11.input.helper = XCreateWindow(_wtk.x11.display, _wtk.x11.root, 0, 0, 1, 1, 0, 0, InputOnly, CopyFromParent, 0, NULL);
 
-- (BOOL)applicationShouldTerminateAfterLastWindowClosed:(NSApplication *)sender {
-    return YES;
-}
+    // Anything already queued belongs to the ring now, ahead of what the thread reads
+    for (XEvent event; XPending(_wtk.x11.display) && _wtk.x11.input.head <= _wtk.x11.input.mask;) {
+        XNextEvent(_wtk.x11.display, &event);
+        _wtk.x11.input.ring[_wtk.x11.input.head].event = event;
+        _wtk.x11.input.ring[_wtk.x11.input.head++].time = _wtk_time_ns();
+    }
 
-- (NSApplicationTerminateReply)applicationShouldTerminate:(NSApplication *)sender {
-    for (wtk_window_t *window = _wtk.window_list; window; window = window->next) {
-        wtk_window_set_closed(window, 1);
-        window->desc.callback(window, &(wtk_event_t){.type = WTK_EVENTTYPE_WINDOWCLOSE});
+    if (pthread_create(&_wtk.x11.input.thread, NULL, _wtk_input_thread, NULL)) {
+        _wtk.x11.input.head = _wtk.x11.input.tail = 0;
+        XDestroyWindow(_wtk.x11.display, _wtk.x11.input.helper);
+        free(_wtk.x11.input.ring);
+        _wtk.x11.input.ring = NULL;
+        return 0;
     }
 
-    return NSTerminateCancel;
+    return 1;
 }
-@end
 
-@implementation _WtkCocoaView {
-    wtk_window_t *m_window;
+static void _wtk_input_thread_stop(void) {
+    if (!_wtk.x11.input.ring)
+        return;
+
+    XEvent stop = {.xclient = {
+        .type = ClientMessage,
+        .window = _wtk.x11.input.helper,
+        .message_type = _wtk.x11.input.stop,
+        .format = 32,
+    }};
+
+    XSendEvent(_wtk.x11.display, _wtk.x11.input.helper, 0, 0, &stop);
+    XFlush(_wtk.x11.display);
+
+    // The thread may be blocked on a full ring, so keep draining until it exits. Dispatching here would run user
+    // callbacks from inside wtk_input_thread_stop, so the events are set aside instead
+    XEvent *kept = NULL;
+    size_t count = 0, cap = 0;
+    for (int done = 0; !done;) {
+        done = __atomic_load_n(&_wtk.x11.input.done, __ATOMIC_ACQUIRE);
+        for (XEvent event; _wtk_next_xevent(&event, 0);) {
+            if (count == cap) {
+                XEvent *grown = realloc(kept, (cap ? cap * 2 : 64) * sizeof *kept);
+                if (!grown)
+                    continue;
+                kept = grown;
+                cap = cap ? cap * 2 : 64;
+            }
+            kept[count++] = event;
+        }
+        if (!done)
+            nanosleep(&(struct timespec){.tv_nsec = 100000}, NULL);
+    }
+
+    pthread_join(_wtk.x11.input.thread, NULL);
+    XDestroyWindow(_wtk.x11.display, _wtk.x11.input.helper);
+    free(_wtk.x11.input.ring);
+    _wtk.x11.input.ring = NULL;
+
+    // Back in front of anything Xlib queued since, in their original order, for the next wtk_poll_events
+    while (count)
+        XPutBackEvent(_wtk.x11.display, &kept[--count]);
+    free(kept);
 }
 
-- (id)initWithFrame:(NSRect)frame window:(wtk_window_t *)window  {
-    NSOpenGLPixelFormatAttribute attributes[] = {
-        NSOpenGLPFAOpenGLProfile,   NSOpenGLProfileVersion4_1Core,
-        NSOpenGLPFAMultisample,
-        NSOpenGLPFAAccelerated,
-        NSOpenGLPFADoubleBuffer,
-        NSOpenGLPFAColorSize,       32,
-        NSOpenGLPFADepthSize,       24,
-        NSOpenGLPFAAlphaSize,        8,
-        0
-    };
+#if !defined(_WTK_EGL)
+static int _wtk_context_create(wtk_context_t *context) {
+    wtk_gl_desc_t gl = context->window->desc.gl;
+    if (!(context->context = _wtk_glx_create_context(context->window->fbconfig, context->window->context, &gl)))
+        return 0;
 
-    if (self = [super initWithFrame:frame pixelFormat:[[[NSOpenGLPixelFormat alloc] initWithAttributes:attributes] autorelease]])
-        m_window = window;
-    return self;
+    // GL 3.0+ contexts from GLX_ARB_create_context may be current with no drawable, otherwise borrow a tiny pbuffer.
+    // Without one the context could never be made current, which is worse than failing here
+    if (gl.major >= 3)
+        return 1;
+
+    int drawable_type = 0;
+    glXGetFBConfigAttrib(_wtk.x11.display, context->window->fbconfig, GLX_DRAWABLE_TYPE, &drawable_type);
+    if (!(drawable_type & GLX_PBUFFER_BIT))
+        return 0;
+
+    int attribs[] = {GLX_PBUFFER_WIDTH, 1, GLX_PBUFFER_HEIGHT, 1, None};
+    _wtk_x11_trap_errors();
+    context->pbuffer = glXCreatePbuffer(_wtk.x11.display, context->window->fbconfig, attribs);
+    if (_wtk_x11_untrap_errors())
+        context->pbuffer = None;
+    return context->pbuffer != None;
 }
 
-- (BOOL)windowShouldClose:(NSNotification *)notification {
-    wtk_window_set_closed(m_window, 1);
-    _wtk_post_event(m_window, WTK_EVENTTYPE_WINDOWCLOSE, NULL);
-    return NO;
+static void _wtk_context_make_current(wtk_context_t *context) {
+    if (context)
+        glXMakeContextCurrent(_wtk.x11.display, context->pbuffer, context->pbuffer, context->context);
+    else
+        glXMakeContextCurrent(_wtk.x11.display, None, None, NULL);
 }
 
-- (void)keyDown:(NSEvent *)event         { _wtk_post_event(m_window, WTK_EVENTTYPE_KEYDOWN, event); }
+static void _wtk_context_delete(wtk_context_t *context) {
+    if (context->pbuffer)
+        glXDestroyPbuffer(_wtk.x11.display, context->pbuffer);
+    if (context->context)
+        glXDestroyContext(_wtk.x11.display, context->context);
+}
+#endif
+
+static void _wtk_destroy_ximages(wtk_window_t *window) {
+    // The server has to be done with a segment before it goes away
+    if (window->ximage.pending[0] || window->ximage.pending[1])
+        XSync(_wtk.x11.display, False);
+
+    for (int i = 0; i < 2; i++) {
+        XImage *image = window->ximage.image[i];
+        if (image && window->ximage.shm[i].shmaddr) {
+            XShmDetach(_wtk.x11.display, &window->ximage.shm[i]);
+            shmdt(window->ximage.shm[i].shmaddr);
+            image->data = NULL;
+        }
+        if (image)
+            XDestroyImage(image);
+    }
+
+    memset(window->ximage.image, 0, sizeof window->ximage.image);
+    memset(window->ximage.shm, 0, sizeof window->ximage.shm);
+    memset(window->ximage.pending, 0, sizeof window->ximage.pending);
+    window->ximage.current = 0;
+}
+
+static XImage *_wtk_create_shm_image(wtk_window_t *window, XShmSegmentInfo *shm, int w, int h) {
+    XImage *image = XShmCreateImage(_wtk.x11.display, window->visual, window->depth, ZPixmap, NULL, shm, w, h);
+    if (!image)
+        return NULL;
+
+    shm->shmid = shmget(IPC_PRIVATE, (size_t)image->bytes_per_line * image->height, IPC_CREAT | 0600);
+    shm->shmaddr = shm->shmid < 0 ? (char *)-1 : shmat(shm->shmid, NULL, 0);
+    shm->readOnly = False;
+    if (shm->shmaddr == (char *)-1) {
+        if (shm->shmid >= 0)
+            shmctl(shm->shmid, IPC_RMID, NULL);
+        shm->shmaddr = NULL;
+        XDestroyImage(image);
+        return NULL;
+    }
+    image->data = shm->shmaddr;
+
+    // A remote server can't attach, which only shows up as an X error
+    _wtk_x11_trap_errors();
+    Status attached = XShmAttach(_wtk.x11.display, shm);
+    int error = _wtk_x11_untrap_errors();
+
+    // Marked for removal right away so the segment can't outlive the process
+    shmctl(shm->shmid, IPC_RMID, NULL);
+
+    if (!attached || error) {
+        shmdt(shm->shmaddr);
+        shm->shmaddr = NULL;
+        image->data = NULL;
+        XDestroyImage(image);
+        return NULL;
+    }
+
+    return image;
+}
+
+static void *_wtk_window_map_pixels(wtk_window_t *window, int w, int h, int *stride) {
+    if (!window->ximage.image[0] || window->ximage.image[0]->width != w || window->ximage.image[0]->height != h) {
+        _wtk_destroy_ximages(window);
+
+        for (int i = 0; _wtk.x11.shm && i < 2; i++) {
+            if (!(window->ximage.image[i] = _wtk_create_shm_image(window, &window->ximage.shm[i], w, h))) {
+                _wtk_destroy_ximages(window);
+                _wtk.x11.shm = 0;
+            }
+        }
+
+        // Without MIT-SHM every present goes over the socket with XPutImage
+        if (!window->ximage.image[0]) {
+            XImage *image = XCreateImage(_wtk.x11.display, window->visual, (unsigned)window->depth, ZPixmap, 0, NULL, (unsigned)w, (unsigned)h, 32, 0);
+            if (image && !(image->data = malloc((size_t)image->bytes_per_line * image->height))) {
+                XDestroyImage(image);
+                image = NULL;
+            }
+            window->ximage.image[0] = image;
+        }
+
+        XImage *image = window->ximage.image[0];
+        if (!image || image->bits_per_pixel != 32 || image->red_mask != 0xff0000 || image->blue_mask != 0xff) {
+            _wtk_destroy_ximages(window);
+            return NULL;
+        }
+
+        if (!window->ximage.gc)
+            window->ximage.gc = XCreateGC(_wtk.x11.display, window->window, 0, NULL);
+    }
+
+    // The completion hasn't been read yet; once a round trip returns the server is done with the segment
+    int current = window->ximage.current;
+    if (window->ximage.pending[current]) {
+        XSync(_wtk.x11.display, False);
+        window->ximage.pending[current] = 0;
+    }
+
+    *stride = window->ximage.image[current]->bytes_per_line;
+    return window->ximage.image[current]->data;
+}
+
+static void _wtk_window_present_pixels(wtk_window_t *window, wtk_rect_t const *rects, int n, int preserve) {
+    int current = window->ximage.current;
+    XImage *image = window->ximage.image[current];
+
+    for (int i = 0; i < n; i++) {
+        wtk_rect_t const *r = &rects[i];
+        if (window->ximage.shm[current].shmaddr)
+            XShmPutImage(_wtk.x11.display, window->window, window->ximage.gc, image, r->x, r->y, r->x, r->y, (unsigned)r->w, (unsigned)r->h, i == n - 1);
+        else
+            XPutImage(_wtk.x11.display, window->window, window->ximage.gc, image, r->x, r->y, r->x, r->y, (unsigned)r->w, (unsigned)r->h);
+    }
+    XFlush(_wtk.x11.display);
+
+    if (!window->ximage.image[1])
+        return;
+
+    // Drawing continues in the other segment while the server reads this one. Bring over
+    // what changed so it still holds the frame just presented
+    window->ximage.pending[current] = 1;
+    window->ximage.current = !current;
+
+    XImage *next = window->ximage.image[!current];
+    for (int i = 0; preserve && i < n; i++)
+        for (int y = rects[i].y; y < rects[i].y + rects[i].h; y++)
+            memcpy(next->data + (size_t)y * next->bytes_per_line + rects[i].x * 4, image->data + (size_t)y * image->bytes_per_line + rects[i].x * 4, (size_t)rects[i].w * 4);
+}
+
+void _wtk_window_delete(wtk_window_t *window) {
+    _wtk_destroy_ximages(window);
+    if (window->ximage.gc)
+        XFreeGC(_wtk.x11.display, window->ximage.gc);
+#if defined(_WTK_EGL)
+    _wtk_egl_window_delete(window);
+#else
+    if (window->context)
+        glXDestroyContext(_wtk.x11.display, window->context);
+#endif
+    if (window->window)
+        XDestroyWindow(_wtk.x11.display, window->window);
+    if (window->colormap)
+        XFreeColormap(_wtk.x11.display, window->colormap);
+}
+
+void _wtk_window_set_pos(wtk_window_t *window, int x, int y) {
+    XMoveWindow(_wtk.x11.display, window->window, x, y);
+}
+
+void _wtk_window_set_size(wtk_window_t *window, int w, int h) {
+    XResizeWindow(_wtk.x11.display, window->window, (unsigned int)w, (unsigned int)h);
+}
+
+void _wtk_window_set_title(wtk_window_t *window, char const *title) {
+    XStoreName(_wtk.x11.display, window->window, title);
+}
+
+static int _wtk_x11_refresh_mhz(XRRModeInfo const *mode) {
+    double lines = mode->vTotal;
+    if (mode->modeFlags & RR_DoubleScan) lines *= 2;
+    if (mode->modeFlags & RR_Interlace)  lines /= 2;
+    return mode->hTotal && lines > 0 ? (int)(mode->dotClock * 1000.0 / (mode->hTotal * lines) + 0.5) : 0;
+}
+
+// Each CRTC scanning out is a monitor, outputs mirroring one another share it
+static int _wtk_monitors_query(wtk_monitor_t *monitors, int cap) {
+    Display *display = _wtk.x11.display;
+
+    // X has no scale of its own, toolkits go by the Xft.dpi resource
+    char const *resources = XResourceManagerString(display);
+    char const *dpi = resources ? strstr(resources, "Xft.dpi:") : NULL;
+    float scale = dpi ? strtof(dpi + 8, NULL) / 96.0f : 1.0f;
+    scale = scale > 0 ? scale : 1.0f;
+
+    if (_wtk.x11.randr_event < 0) {
+        if (cap < 1)
+            return 0;
+        monitors[0] = (wtk_monitor_t){
+            .id      = _wtk.x11.root,
+            .w       = DisplayWidth(display, _wtk.x11.screen),
+            .h       = DisplayHeight(display, _wtk.x11.screen),
+            .mm_w    = DisplayWidthMM(display, _wtk.x11.screen),
+            .mm_h    = DisplayHeightMM(display, _wtk.x11.screen),
+            .scale   = scale,
+            .primary = 1,
+        };
+        snprintf(monitors[0].name, sizeof monitors[0].name, "%s", DisplayString(display));
+        return 1;
+    }
+
+    XRRScreenResources *screen = XRRGetScreenResourcesCurrent(display, _wtk.x11.root);
+    if (!screen)
+        return 0;
+
+    RROutput primary = XRRGetOutputPrimary(display, _wtk.x11.root);
+    int count = 0;
+    for (int i = 0; i < screen->ncrtc && count < cap; i++) {
+        XRRCrtcInfo *crtc = XRRGetCrtcInfo(display, screen, screen->crtcs[i]);
+        if (!crtc)
+            continue;
+
+        if (crtc->mode != None && crtc->noutput > 0) {
+            wtk_monitor_t *monitor = &monitors[count++];
+            *monitor = (wtk_monitor_t){
+                .id    = screen->crtcs[i],
+                .x     = crtc->x,
+                .y     = crtc->y,
+                .w     = (int)crtc->width,
+                .h     = (int)crtc->height,
+                .scale = scale,
+            };
+
+            for (int j = 0; j < screen->nmode; j++)
+                if (screen->modes[j].id == crtc->mode)
+                    monitor->refresh_mhz = _wtk_x11_refresh_mhz(&screen->modes[j]);
+            for (int j = 0; j < crtc->noutput; j++)
+                monitor->primary |= crtc->outputs[j] == primary;
+
+            XRROutputInfo *output = XRRGetOutputInfo(display, screen, crtc->outputs[0]);
+            if (output) {
+                snprintf(monitor->name, sizeof monitor->name, "%s", output->name);
+                monitor->mm_w = (int)output->mm_width;
+                monitor->mm_h = (int)output->mm_height;
+                XRRFreeOutputInfo(output);
+            }
+        }
+        XRRFreeCrtcInfo(crtc);
+    }
+
+    XRRFreeScreenResources(screen);
+    return count;
+}
+
+// ConfigureNotify positions can be relative to the window manager's frame, so ask the server where the window is
+static uintptr_t _wtk_window_monitor(wtk_window_t const *window) {
+    int x, y;
+    Window child;
+    if (!XTranslateCoordinates(_wtk.x11.display, window->window, _wtk.x11.root, 0, 0, &x, &y, &child))
+        return 0;
+
+    uintptr_t best = 0;
+    long best_area = 0;
+    for (int i = 0; i < _wtk.monitors.count; i++) {
+        wtk_monitor_t const *monitor = &_wtk.monitors.list[i];
+        long w = (long)(x + window->desc.w < monitor->x + monitor->w ? x + window->desc.w : monitor->x + monitor->w) - (x > monitor->x ? x : monitor->x);
+        long h = (long)(y + window->desc.h < monitor->y + monitor->h ? y + window->desc.h : monitor->y + monitor->h) - (y > monitor->y ? y : monitor->y);
+        if (w > 0 && h > 0 && w * h > best_area) {
+            best_area = w * h;
+            best = monitor->id;
+        }
+    }
+    return best;
+}
+
+static wtk_native_t _wtk_window_native(wtk_window_t const *window) {
+    return (wtk_native_t){.display = _wtk.x11.display, .window = window->window};
+}
+
+// }}}
+// Wayland {{{
+
+#elif defined(WTK_API_WAYLAND)
+
+// xdg-shell as wayland-scanner would generate it, version 1, so building needs no protocol XML
+static const struct wl_interface _wtk_xdg_wm_base_interface, _wtk_xdg_surface_interface, _wtk_xdg_toplevel_interface;
+
+static const struct wl_interface *_wtk_xdg_types[] = {
+    NULL, NULL, NULL, NULL,
+    NULL,                                                   // create_positioner, never sent
+    &_wtk_xdg_surface_interface, &wl_surface_interface,     // get_xdg_surface
+    &_wtk_xdg_toplevel_interface,                           // get_toplevel
+    NULL, &_wtk_xdg_surface_interface, NULL,                // get_popup, never sent
+    &_wtk_xdg_toplevel_interface,                           // set_parent
+    &wl_seat_interface, NULL, NULL, NULL,                   // show_window_menu
+    &wl_seat_interface, NULL,                               // move
+    &wl_seat_interface, NULL, NULL,                         // resize
+    &wl_output_interface,                                   // set_fullscreen
+};
+
+static const struct wl_message _wtk_xdg_wm_base_requests[] = {
+    {"destroy",             "",         _wtk_xdg_types + 0},
+    {"create_positioner",   "n",        _wtk_xdg_types + 4},
+    {"get_xdg_surface",     "no",       _wtk_xdg_types + 5},
+    {"pong",                "u",        _wtk_xdg_types + 0},
+};
+
+static const struct wl_message _wtk_xdg_wm_base_events[] = {
+    {"ping",                "u",        _wtk_xdg_types + 0},
+};
+
+static const struct wl_message _wtk_xdg_surface_requests[] = {
+    {"destroy",             "",         _wtk_xdg_types + 0},
+    {"get_toplevel",        "n",        _wtk_xdg_types + 7},
+    {"get_popup",           "n?oo",     _wtk_xdg_types + 8},
+    {"set_window_geometry", "iiii",     _wtk_xdg_types + 0},
+    {"ack_configure",       "u",        _wtk_xdg_types + 0},
+};
+
+static const struct wl_message _wtk_xdg_surface_events[] = {
+    {"configure",           "u",        _wtk_xdg_types + 0},
+};
+
+static const struct wl_message _wtk_xdg_toplevel_requests[] = {
+    {"destroy",             "",         _wtk_xdg_types + 0},
+    {"set_parent",          "?o",       _wtk_xdg_types + 11},
+    {"set_title",           "s",        _wtk_xdg_types + 0},
+    {"set_app_id",          "s",        _wtk_xdg_types + 0},
+    {"show_window_menu",    "ouii",     _wtk_xdg_types + 12},
+    {"move",                "ou",       _wtk_xdg_types + 16},
+    {"resize",              "ouu",      _wtk_xdg_types + 18},
+    {"set_max_size",        "ii",       _wtk_xdg_types + 0},
+    {"set_min_size",        "ii",       _wtk_xdg_types + 0},
+    {"set_maximized",       "",         _wtk_xdg_types + 0},
+    {"unset_maximized",     "",         _wtk_xdg_types + 0},
+    {"set_fullscreen",      "?o",       _wtk_xdg_types + 21},
+    {"unset_fullscreen",    "",         _wtk_xdg_types + 0},
+    {"set_minimized",       "",         _wtk_xdg_types + 0},
+};
+
+static const struct wl_message _wtk_xdg_toplevel_events[] = {
+    {"configure",           "iia",      _wtk_xdg_types + 0},
+    {"close",               "",         _wtk_xdg_types + 0},
+};
+
+static const struct wl_interface _wtk_xdg_wm_base_interface = {"xdg_wm_base", 1, 4, _wtk_xdg_wm_base_requests, 1, _wtk_xdg_wm_base_events};
+static const struct wl_interface _wtk_xdg_surface_interface = {"xdg_surface", 1, 5, _wtk_xdg_surface_requests, 1, _wtk_xdg_surface_events};
+static const struct wl_interface _wtk_xdg_toplevel_interface = {"xdg_toplevel", 1, 14, _wtk_xdg_toplevel_requests, 2, _wtk_xdg_toplevel_events};
+
+// Request opcodes, the index into the tables above
+#define _WTK_XDG_DESTROY                0
+#define _WTK_XDG_WM_BASE_GET_XDG_SURFACE 2
+#define _WTK_XDG_WM_BASE_PONG           3
+#define _WTK_XDG_SURFACE_GET_TOPLEVEL   1
+#define _WTK_XDG_SURFACE_ACK_CONFIGURE  4
+#define _WTK_XDG_TOPLEVEL_SET_TITLE     2
+
+typedef struct _WtkXdgWmBaseListener {
+    void (*ping)(void *data, struct xdg_wm_base *wm_base, uint32_t serial);
+} _WtkXdgWmBaseListener;
+
+typedef struct _WtkXdgSurfaceListener {
+    void (*configure)(void *data, struct xdg_surface *surface, uint32_t serial);
+} _WtkXdgSurfaceListener;
+
+typedef struct _WtkXdgToplevelListener {
+    void (*configure)(void *data, struct xdg_toplevel *toplevel, int32_t w, int32_t h, struct wl_array *states);
+    void (*close)(void *data, struct xdg_toplevel *toplevel);
+} _WtkXdgToplevelListener;
+
+static void _wtk_xdg_destroy(void *object) {
+    wl_proxy_marshal_flags((struct wl_proxy *)object, _WTK_XDG_DESTROY, NULL, wl_proxy_get_version((struct wl_proxy *)object), WL_MARSHAL_FLAG_DESTROY);
+}
+
+static uint64_t _wtk_time_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Input timestamps are wrapping 32-bit milliseconds. Weston, Mutter and KWin take them from CLOCK_MONOTONIC;
+// if the age doesn't look sane the clocks differ, so use the read time
+static uint64_t _wtk_event_time_ns(uint32_t time) {
+    uint64_t received_ms = _wtk.wayland.time / 1000000;
+    uint32_t age_ms = (uint32_t)received_ms - time;
+    return age_ms < 10000 ? (received_ms - age_ms) * 1000000 : _wtk.wayland.time;
+}
+
+static int _wtk_translate_keysym(xkb_keysym_t sym) {
+    switch (sym) {
+        case XKB_KEY_BackSpace: return WTK_KEY_BACKSPACE;
+        case XKB_KEY_Tab:       return WTK_KEY_TAB;
+        case XKB_KEY_Return:    return WTK_KEY_ENTER;
+        case XKB_KEY_Escape:    return WTK_KEY_ESCAPE;
+        case XKB_KEY_Up:        return WTK_KEY_UP;
+        case XKB_KEY_Down:      return WTK_KEY_DOWN;
+        case XKB_KEY_Left:      return WTK_KEY_LEFT;
+        case XKB_KEY_Right:     return WTK_KEY_RIGHT;
+        case XKB_KEY_Page_Up:   return WTK_KEY_PAGEUP;
+        case XKB_KEY_Page_Down: return WTK_KEY_PAGEDOWN;
+        case XKB_KEY_Home:      return WTK_KEY_HOME;
+        case XKB_KEY_End:       return WTK_KEY_END;
+        case XKB_KEY_Insert:    return WTK_KEY_INSERT;
+        case XKB_KEY_Delete:    return WTK_KEY_DELETE;
+        case XKB_KEY_F1:        return WTK_KEY_F1;
+        case XKB_KEY_F2:        return WTK_KEY_F2;
+        case XKB_KEY_F3:        return WTK_KEY_F3;
+        case XKB_KEY_F4:        return WTK_KEY_F4;
+        case XKB_KEY_F5:        return WTK_KEY_F5;
+        case XKB_KEY_F6:        return WTK_KEY_F6;
+        case XKB_KEY_F7:        return WTK_KEY_F7;
+        case XKB_KEY_F8:        return WTK_KEY_F8;
+        case XKB_KEY_F9:        return WTK_KEY_F9;
+        case XKB_KEY_F10:       return WTK_KEY_F10;
+        case XKB_KEY_F11:       return WTK_KEY_F11;
+        case XKB_KEY_F12:       return WTK_KEY_F12;
+        case XKB_KEY_Shift_L:   return WTK_KEY_LSHIFT;
+        case XKB_KEY_Shift_R:   return WTK_KEY_RSHIFT;
+        case XKB_KEY_Control_L: return WTK_KEY_LCTRL;
+        case XKB_KEY_Control_R: return WTK_KEY_RCTRL;
+        case XKB_KEY_Super_L:   return WTK_KEY_LSUPER;
+        case XKB_KEY_Super_R:   return WTK_KEY_RSUPER;
+        case XKB_KEY_Alt_L:     return WTK_KEY_LALT;
+        case XKB_KEY_Alt_R:     return WTK_KEY_RALT;
+        case XKB_KEY_Caps_Lock: return WTK_KEY_CAPSLOCK;
+        default:                return (int)sym;
+    }
+}
+
+// Same table as X11, resolved once per keymap so key events are a lookup
+static void _wtk_update_keymap(void) {
+    memset(_wtk.wayland.keys, 0, sizeof _wtk.wayland.keys);
+    for (xkb_keycode_t keycode = 0; keycode < 256; keycode++) {
+        for (int shifted = 0; shifted < 2; shifted++) {
+            xkb_keysym_t const *syms;
+            if (xkb_keymap_key_get_syms_by_level(_wtk.wayland.keymap, keycode, 0, (xkb_level_index_t)shifted, &syms) > 0)
+                _wtk.wayland.keys[keycode][shifted] = _wtk_translate_keysym(syms[0]);
+        }
+    }
+}
+
+static void _wtk_flush_motion(wtk_window_t *window) {
+    if (window->motion.merged < 0)
+        return;
+
+    wtk_event_t event = window->motion;
+    window->motion.merged = -1;
+    _wtk_dispatch_event(window, &event);
+}
+
+static void _wtk_post_event(wtk_window_t *window, wtk_event_t const *event) {
+    // Coalesced motion goes out first so the order of events is kept. Its callback may delete the window
+    uint32_t deleted = _wtk.deleted;
+    _wtk_flush_motion(window);
+    if (deleted == _wtk.deleted)
+        _wtk_dispatch_event(window, event);
+}
+
+static void _wtk_post_configure(wtk_window_t *window) {
+    if (window->resized) {
+        wtk_event_t event = {.type = WTK_EVENTTYPE_WINDOWRESIZE, .merged = window->resized - 1, .time_ns = _wtk.wayland.time};
+        window->resized = 0;
+        _wtk_post_event(window, &event);
+    }
+}
+
+static void _wtk_pointer_enter(void *data, struct wl_pointer *pointer, uint32_t serial, struct wl_surface *surface, wl_fixed_t x, wl_fixed_t y) {
+    (void)data; (void)pointer; (void)serial;
+    wtk_window_t *window = surface ? _wtk_window_find((uintptr_t)surface) : NULL;
+    if (!(_wtk.wayland.pointer_focus = window))
+        return;
+
+    window->mouse_x = wl_fixed_to_int(x);
+    window->mouse_y = wl_fixed_to_int(y);
+    wtk_event_t event = {.type = WTK_EVENTTYPE_MOUSEENTER, .location = {window->mouse_x, window->mouse_y}, .mods = _wtk.wayland.mods, .time_ns = _wtk.wayland.time};
+    _wtk_post_event(window, &event);
+}
+
+static void _wtk_pointer_leave(void *data, struct wl_pointer *pointer, uint32_t serial, struct wl_surface *surface) {
+    (void)data; (void)pointer; (void)serial; (void)surface;
+    wtk_window_t *window = _wtk.wayland.pointer_focus;
+    if (!window)
+        return;
+
+    _wtk.wayland.pointer_focus = NULL;
+    wtk_event_t event = {.type = WTK_EVENTTYPE_MOUSELEAVE, .location = {window->mouse_x, window->mouse_y}, .mods = _wtk.wayland.mods, .time_ns = _wtk.wayland.time};
+    _wtk_post_event(window, &event);
+}
+
+static void _wtk_pointer_motion(void *data, struct wl_pointer *pointer, uint32_t time, wl_fixed_t x, wl_fixed_t y) {
+    (void)data; (void)pointer;
+    wtk_window_t *window = _wtk.wayland.pointer_focus;
+    if (!window)
+        return;
+
+    wtk_event_t event = {
+        .type     = WTK_EVENTTYPE_MOUSEMOTION,
+        .mods     = _wtk.wayland.mods,
+        .location = {wl_fixed_to_int(x), wl_fixed_to_int(y)},
+        .time_ns  = _wtk_event_time_ns(time),
+    };
+    event.delta.x = event.location.x - window->mouse_x;
+    event.delta.y = event.location.y - window->mouse_y;
+    window->mouse_x = event.location.x;
+    window->mouse_y = event.location.y;
+
+    if (!window->desc.coalesce) {
+        _wtk_post_event(window, &event);
+        return;
+    }
+
+    // Events come one callback at a time, so the run is held back and folded until something else arrives
+    if (window->motion.merged >= 0) {
+        event.delta.x += window->motion.delta.x;
+        event.delta.y += window->motion.delta.y;
+        event.merged = window->motion.merged + 1;
+    }
+    window->motion = event;
+}
+
+static void _wtk_pointer_button(void *data, struct wl_pointer *pointer, uint32_t serial, uint32_t time, uint32_t button, uint32_t state) {
+    (void)data; (void)pointer; (void)serial;
+    wtk_window_t *window = _wtk.wayland.pointer_focus;
+    if (!window || button < _WTK_BTN_LEFT || button > _WTK_BTN_LEFT + WTK_BUTTON_8)
+        return;
+
+    wtk_event_t event = {
+        .type     = state == WL_POINTER_BUTTON_STATE_PRESSED ? WTK_EVENTTYPE_MOUSEDOWN : WTK_EVENTTYPE_MOUSEUP,
+        .button   = (int)(button - _WTK_BTN_LEFT),
+        .mods     = _wtk.wayland.mods,
+        .location = {window->mouse_x, window->mouse_y},
+        .time_ns  = _wtk_event_time_ns(time),
+    };
+    _wtk_post_event(window, &event);
+}
+
+static void _wtk_pointer_axis(void *data, struct wl_pointer *pointer, uint32_t time, uint32_t axis, wl_fixed_t value) {
+    (void)data; (void)pointer;
+    wtk_window_t *window = _wtk.wayland.pointer_focus;
+    if (!window || axis > WL_POINTER_AXIS_HORIZONTAL_SCROLL)
+        return;
+
+    // A wheel notch is 10 units; touchpads send fractions, which add up to whole steps here. Positive is down/right on
+    // Wayland and up/right in wtk
+    int *scroll = &window->scroll[axis];
+    *scroll += value;
+    int steps = *scroll / wl_fixed_from_int(10);
+    if (!steps)
+        return;
+
+    *scroll -= steps * wl_fixed_from_int(10);
+    wtk_event_t event = {
+        .type     = WTK_EVENTTYPE_MOUSESCROLL,
+        .mods     = _wtk.wayland.mods,
+        .location = {window->mouse_x, window->mouse_y},
+        .time_ns  = _wtk_event_time_ns(time),
+    };
+    if (axis == WL_POINTER_AXIS_VERTICAL_SCROLL)
+        event.delta.y = -steps;
+    else
+        event.delta.x = steps;
+    _wtk_post_event(window, &event);
+}
+
+static const struct wl_pointer_listener _wtk_pointer_listener = {
+    .enter  = _wtk_pointer_enter,
+    .leave  = _wtk_pointer_leave,
+    .motion = _wtk_pointer_motion,
+    .button = _wtk_pointer_button,
+    .axis   = _wtk_pointer_axis,
+};
+
+static void _wtk_keyboard_keymap(void *data, struct wl_keyboard *keyboard, uint32_t format, int32_t fd, uint32_t size) {
+    (void)data; (void)keyboard;
+    if (format != WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1) {
+        close(fd);
+        return;
+    }
+
+    // Must be mapped private from version 7 on
+    char *text = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (text == MAP_FAILED)
+        return;
+
+    struct xkb_keymap *keymap = xkb_keymap_new_from_string(_wtk.wayland.xkb, text, XKB_KEYMAP_FORMAT_TEXT_V1, XKB_KEYMAP_COMPILE_NO_FLAGS);
+    munmap(text, size);
+    if (!keymap)
+        return;
+
+    struct xkb_state *state = xkb_state_new(keymap);
+    if (!state) {
+        xkb_keymap_unref(keymap);
+        return;
+    }
+
+    xkb_state_unref(_wtk.wayland.state);
+    xkb_keymap_unref(_wtk.wayland.keymap);
+    _wtk.wayland.keymap = keymap;
+    _wtk.wayland.state = state;
+    _wtk_update_keymap();
+}
+
+static void _wtk_keyboard_enter(void *data, struct wl_keyboard *keyboard, uint32_t serial, struct wl_surface *surface, struct wl_array *keys) {
+    (void)data; (void)keyboard; (void)serial; (void)keys;
+    wtk_window_t *window = surface ? _wtk_window_find((uintptr_t)surface) : NULL;
+    if (!(_wtk.wayland.keyboard_focus = window))
+        return;
+
+    wtk_event_t event = {.type = WTK_EVENTTYPE_WINDOWFOCUSIN, .time_ns = _wtk.wayland.time};
+    _wtk_post_event(window, &event);
+}
+
+static void _wtk_keyboard_leave(void *data, struct wl_keyboard *keyboard, uint32_t serial, struct wl_surface *surface) {
+    (void)data; (void)keyboard; (void)serial; (void)surface;
+    wtk_window_t *window = _wtk.wayland.keyboard_focus;
+    if (!window)
+        return;
+
+    _wtk.wayland.keyboard_focus = NULL;
+
+    // Keys let go while another surface has focus are never reported, so release whatever is held now. A KEYUP
+    // callback may delete the window; the keys left are still let go of, just without telling anyone
+    uint32_t deleted = _wtk.deleted;
+    for (int keycode = 0; keycode < 256; keycode++) {
+        if (!_wtk.wayland.held[keycode].down)
+            continue;
+
+        _wtk.wayland.held[keycode].down = 0;
+        if (deleted != _wtk.deleted)
+            continue;
+
+        wtk_event_t event = {.type = WTK_EVENTTYPE_KEYUP, .key = _wtk.wayland.held[keycode].key, .mods = _wtk.wayland.mods, .time_ns = _wtk.wayland.time};
+        _wtk_post_event(window, &event);
+    }
+
+    if (deleted != _wtk.deleted)
+        return;
+
+    wtk_event_t event = {.type = WTK_EVENTTYPE_WINDOWFOCUSOUT, .time_ns = _wtk.wayland.time};
+    _wtk_post_event(window, &event);
+}
+
+static void _wtk_keyboard_key(void *data, struct wl_keyboard *keyboard, uint32_t serial, uint32_t time, uint32_t key, uint32_t state) {
+    (void)data; (void)keyboard; (void)serial;
+    wtk_window_t *window = _wtk.wayland.keyboard_focus;
+    if (!window)
+        return;
+
+    // Wayland sends evdev codes, xkb keycodes are offset by 8. Repeating is left to clients, so every press is a real one
+    int type = state == WL_KEYBOARD_KEY_STATE_PRESSED ? WTK_EVENTTYPE_KEYDOWN : WTK_EVENTTYPE_KEYUP;
+    unsigned keycode = (key + 8) & 0xff;
+    if (!_wtk.wayland.held[keycode].down)
+        _wtk.wayland.held[keycode].key = _wtk.wayland.keys[keycode][(_wtk.wayland.mods & WTK_MOD_SHIFT) ? 1 : 0];
+    _wtk.wayland.held[keycode].down = type == WTK_EVENTTYPE_KEYDOWN;
+
+    wtk_event_t event = {
+        .type     = type,
+        .key      = _wtk.wayland.held[keycode].key,
+        .mods     = _wtk.wayland.mods,
+        .location = {window->mouse_x, window->mouse_y},
+        .time_ns  = _wtk_event_time_ns(time),
+    };
+
+    // The modifiers event for this key comes after it, so fold in the key itself like on X11
+    int mod = 0;
+    switch (event.key) {
+        case WTK_KEY_LSHIFT: case WTK_KEY_RSHIFT: mod = WTK_MOD_SHIFT; break;
+        case WTK_KEY_LCTRL:  case WTK_KEY_RCTRL:  mod = WTK_MOD_CTRL;  break;
+        case WTK_KEY_LALT:   case WTK_KEY_RALT:   mod = WTK_MOD_ALT;   break;
+        case WTK_KEY_LSUPER: case WTK_KEY_RSUPER: mod = WTK_MOD_SUPER; break;
+    }
+    event.mods = type == WTK_EVENTTYPE_KEYDOWN ? event.mods | mod : event.mods & ~mod;
+    _wtk_post_event(window, &event);
+}
+
+static void _wtk_keyboard_modifiers(void *data, struct wl_keyboard *keyboard, uint32_t serial, uint32_t depressed, uint32_t latched, uint32_t locked, uint32_t group) {
+    (void)data; (void)keyboard; (void)serial;
+    if (!_wtk.wayland.state)
+        return;
+
+    xkb_state_update_mask(_wtk.wayland.state, depressed, latched, locked, 0, 0, group);
+
+    struct { char const *name; int mod; } mods[] = {
+        {XKB_MOD_NAME_SHIFT, WTK_MOD_SHIFT},
+        {XKB_MOD_NAME_CTRL,  WTK_MOD_CTRL},
+        {XKB_MOD_NAME_ALT,   WTK_MOD_ALT},
+        {XKB_MOD_NAME_LOGO,  WTK_MOD_SUPER},
+        {XKB_MOD_NAME_CAPS,  WTK_MOD_CAPSLOCK},
+    };
+
+    _wtk.wayland.mods = 0;
+    for (size_t i = 0; i < sizeof mods / sizeof *mods; i++)
+        if (xkb_state_mod_name_is_active(_wtk.wayland.state, mods[i].name, XKB_STATE_MODS_EFFECTIVE) > 0)
+            _wtk.wayland.mods |= mods[i].mod;
+}
+
+static const struct wl_keyboard_listener _wtk_keyboard_listener = {
+    .keymap    = _wtk_keyboard_keymap,
+    .enter     = _wtk_keyboard_enter,
+    .leave     = _wtk_keyboard_leave,
+    .key       = _wtk_keyboard_key,
+    .modifiers = _wtk_keyboard_modifiers,
+};
+
+static void _wtk_seat_capabilities(void *data, struct wl_seat *seat, uint32_t caps) {
+    (void)data;
+    if ((caps & WL_SEAT_CAPABILITY_POINTER) && !_wtk.wayland.pointer) {
+        _wtk.wayland.pointer = wl_seat_get_pointer(seat);
+        wl_pointer_add_listener(_wtk.wayland.pointer, &_wtk_pointer_listener, NULL);
+    } else if (!(caps & WL_SEAT_CAPABILITY_POINTER) && _wtk.wayland.pointer) {
+        wl_pointer_destroy(_wtk.wayland.pointer);
+        _wtk.wayland.pointer = NULL;
+        _wtk.wayland.pointer_focus = NULL;
+    }
+
+    if ((caps & WL_SEAT_CAPABILITY_KEYBOARD) && !_wtk.wayland.keyboard) {
+        _wtk.wayland.keyboard = wl_seat_get_keyboard(seat);
+        wl_keyboard_add_listener(_wtk.wayland.keyboard, &_wtk_keyboard_listener, NULL);
+    } else if (!(caps & WL_SEAT_CAPABILITY_KEYBOARD) && _wtk.wayland.keyboard) {
+        wl_keyboard_destroy(_wtk.wayland.keyboard);
+        _wtk.wayland.keyboard = NULL;
+        _wtk.wayland.keyboard_focus = NULL;
+    }
+}
+
+static const struct wl_seat_listener _wtk_seat_listener = {
+    .capabilities = _wtk_seat_capabilities,
+};
+
+static void _wtk_wm_base_ping(void *data, struct xdg_wm_base *wm_base, uint32_t serial) {
+    (void)data;
+    wl_proxy_marshal_flags((struct wl_proxy *)wm_base, _WTK_XDG_WM_BASE_PONG, NULL, wl_proxy_get_version((struct wl_proxy *)wm_base), 0, serial);
+}
+
+static const _WtkXdgWmBaseListener _wtk_wm_base_listener = {
+    .ping = _wtk_wm_base_ping,
+};
+
+static void _wtk_output_geometry(void *data, struct wl_output *output, int32_t x, int32_t y, int32_t mm_w, int32_t mm_h, int32_t subpixel, char const *make, char const *model, int32_t transform) {
+    (void)output; (void)subpixel;
+    wtk_monitor_t *monitor = &_wtk.wayland.outputs[(uintptr_t)data].monitor;
+    monitor->x    = x;
+    monitor->y    = y;
+    monitor->mm_w = mm_w;
+    monitor->mm_h = mm_h;
+    _wtk.wayland.outputs[(uintptr_t)data].transform = transform;
+
+    // Version 4 sends a proper name afterwards
+    snprintf(monitor->name, sizeof monitor->name, "%s %s", make, model);
+}
+
+static void _wtk_output_mode(void *data, struct wl_output *output, uint32_t flags, int32_t w, int32_t h, int32_t refresh) {
+    (void)output;
+    if (!(flags & WL_OUTPUT_MODE_CURRENT))
+        return;
+
+    _wtk.wayland.outputs[(uintptr_t)data].mode_w = w;
+    _wtk.wayland.outputs[(uintptr_t)data].mode_h = h;
+    _wtk.wayland.outputs[(uintptr_t)data].monitor.refresh_mhz = refresh;
+}
+
+// Outputs describe themselves in a burst ended by done, so that is when the monitor changes
+static void _wtk_output_done(void *data, struct wl_output *output) {
+    (void)output;
+    wtk_monitor_t *monitor = &_wtk.wayland.outputs[(uintptr_t)data].monitor;
+    int scale = _wtk.wayland.outputs[(uintptr_t)data].scale;
+    int w = _wtk.wayland.outputs[(uintptr_t)data].mode_w, h = _wtk.wayland.outputs[(uintptr_t)data].mode_h;
+
+    // The mode is in hardware pixels, before the output is rotated; surfaces are sized in scaled units
+    int rotated = _wtk.wayland.outputs[(uintptr_t)data].transform & 1;
+    monitor->w = (rotated ? h : w) / scale;
+    monitor->h = (rotated ? w : h) / scale;
+    monitor->scale = (float)scale;
+    _wtk_monitors_changed();
+}
+
+static void _wtk_output_scale(void *data, struct wl_output *output, int32_t factor) {
+    (void)output;
+    _wtk.wayland.outputs[(uintptr_t)data].scale = factor > 0 ? factor : 1;
+}
+
+static void _wtk_output_name(void *data, struct wl_output *output, char const *name) {
+    (void)output;
+    wtk_monitor_t *monitor = &_wtk.wayland.outputs[(uintptr_t)data].monitor;
+    snprintf(monitor->name, sizeof monitor->name, "%s", name);
+}
+
+static void _wtk_output_description(void *data, struct wl_output *output, char const *description) {
+    (void)data; (void)output; (void)description;
+}
+
+static const struct wl_output_listener _wtk_output_listener = {
+    .geometry    = _wtk_output_geometry,
+    .mode        = _wtk_output_mode,
+    .done        = _wtk_output_done,
+    .scale       = _wtk_output_scale,
+    .name        = _wtk_output_name,
+    .description = _wtk_output_description,
+};
+
+static void _wtk_output_release(struct wl_output *output) {
+    if (wl_proxy_get_version((struct wl_proxy *)output) >= 3)
+        wl_output_release(output);
+    else
+        wl_output_destroy(output);
+}
+
+static void _wtk_registry_global(void *data, struct wl_registry *registry, uint32_t name, char const *interface, uint32_t version) {
+    (void)data;
+    // Only the first seat is used
+    if (!strcmp(interface, wl_compositor_interface.name)) {
+        _wtk.wayland.compositor_version = version < 4 ? version : 4;
+        _wtk.wayland.compositor = wl_registry_bind(registry, name, &wl_compositor_interface, _wtk.wayland.compositor_version);
+    } else if (!strcmp(interface, wl_shm_interface.name)) {
+        _wtk.wayland.shm = wl_registry_bind(registry, name, &wl_shm_interface, 1);
+    } else if (!strcmp(interface, wl_seat_interface.name) && !_wtk.wayland.seat) {
+        _wtk.wayland.seat = wl_registry_bind(registry, name, &wl_seat_interface, 1);
+        wl_seat_add_listener(_wtk.wayland.seat, &_wtk_seat_listener, NULL);
+    } else if (!strcmp(interface, _wtk_xdg_wm_base_interface.name)) {
+        _wtk.wayland.wm_base = wl_registry_bind(registry, name, &_wtk_xdg_wm_base_interface, 1);
+        wl_proxy_add_listener((struct wl_proxy *)_wtk.wayland.wm_base, (void (**)(void))&_wtk_wm_base_listener, NULL);
+    } else if (!strcmp(interface, wl_output_interface.name)) {
+        // Version 1 has no done event, which is what applies a description
+        for (uintptr_t i = 0; i < _WTK_MAX_MONITORS && version >= 2; i++) {
+            if (_wtk.wayland.outputs[i].output)
+                continue;
+
+            _wtk.wayland.outputs[i].name  = name;
+            _wtk.wayland.outputs[i].scale = 1;
+            _wtk.wayland.outputs[i].monitor = (wtk_monitor_t){.scale = 1};
+            _wtk.wayland.outputs[i].output = wl_registry_bind(registry, name, &wl_output_interface, version < 4 ? version : 4);
+            _wtk.wayland.outputs[i].monitor.id = (uintptr_t)_wtk.wayland.outputs[i].output;
+            wl_output_add_listener(_wtk.wayland.outputs[i].output, &_wtk_output_listener, (void *)i);
+            break;
+        }
+    }
+}
+
+static void _wtk_registry_global_remove(void *data, struct wl_registry *registry, uint32_t name) {
+    (void)data; (void)registry;
+    for (int i = 0; i < _WTK_MAX_MONITORS; i++) {
+        if (!_wtk.wayland.outputs[i].output || _wtk.wayland.outputs[i].name != name)
+            continue;
+
+        for (wtk_window_t *it = _wtk.window_list; it; it = it->next)
+            if (it->output == _wtk.wayland.outputs[i].output)
+                it->output = NULL;
+
+        _wtk_output_release(_wtk.wayland.outputs[i].output);
+        _wtk.wayland.outputs[i].output = NULL;
+        _wtk_monitors_changed();
+    }
+}
+
+static const struct wl_registry_listener _wtk_registry_listener = {
+    .global        = _wtk_registry_global,
+    .global_remove = _wtk_registry_global_remove,
+};
+
+// Reads what the socket has for up to ms into the event queues, without dispatching. With wakeup,
+// wtk_post_empty_event ends the wait too. Returns -1 once the connection is broken
+static int _wtk_wayland_read(struct wl_event_queue *queue, int ms, int wakeup) {
+    struct wl_display *display = _wtk.wayland.display;
+
+    // Fails while queue still holds events, which the caller dispatches before waiting for more
+    if ((queue ? wl_display_prepare_read_queue(display, queue) : wl_display_prepare_read(display)) < 0)
+        return 0;
+
+    // A full socket only means the rest goes out with a later flush
+    wl_display_flush(display);
+
+    struct pollfd fds[] = {
+        {.fd = wl_display_get_fd(display), .events = POLLIN},
+        {.fd = _wtk.wayland.wakeup[0],     .events = POLLIN},
+    };
+    while (poll(fds, wakeup ? 2 : 1, ms) < 0 && errno == EINTR)
+        ;
+
+    if (wakeup && (fds[1].revents & POLLIN))
+        for (char buf[64]; read(_wtk.wayland.wakeup[0], buf, sizeof buf) > 0;)
+            ;
+
+    if (!(fds[0].revents & (POLLIN | POLLERR | POLLHUP))) {
+        wl_display_cancel_read(display);
+        return 0;
+    }
+
+    _wtk.wayland.time = _wtk_time_ns();
+    return wl_display_read_events(display);
+}
+
+// Dispatches the private queue, waiting up to ms for something to arrive if it was empty
+static int _wtk_wayland_pump_queue(int ms) {
+    struct wl_display *display = _wtk.wayland.display;
+    int n = wl_display_dispatch_queue_pending(display, _wtk.wayland.queue);
+    if (n)
+        return n;
+
+    if (_wtk_wayland_read(_wtk.wayland.queue, ms, 0) < 0)
+        return -1;
+    return wl_display_dispatch_queue_pending(display, _wtk.wayland.queue);
+}
+
+static int _wtk_init(void) {
+    if (!(_wtk.wayland.display = wl_display_connect(NULL)))
+        return 0;
+
+    // One round trip for the globals, another for the seat's capabilities and keymap
+    _wtk.wayland.registry = wl_display_get_registry(_wtk.wayland.display);
+    wl_registry_add_listener(_wtk.wayland.registry, &_wtk_registry_listener, NULL);
+    _wtk.wayland.xkb = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
+    if (!_wtk.wayland.xkb || wl_display_roundtrip(_wtk.wayland.display) < 0 || wl_display_roundtrip(_wtk.wayland.display) < 0)
+        return 0;
+
+    if (!_wtk.wayland.compositor || !_wtk.wayland.wm_base)
+        return 0;
+
+    if (!(_wtk.wayland.queue = wl_display_create_queue(_wtk.wayland.display)))
+        return 0;
+
+    PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+
+    EGLDisplay display = EGL_NO_DISPLAY;
+    if (get_platform_display)
+        display = get_platform_display(EGL_PLATFORM_WAYLAND_KHR, _wtk.wayland.display, NULL);
+    if (display == EGL_NO_DISPLAY)
+        display = eglGetDisplay((EGLNativeDisplayType)_wtk.wayland.display);
+
+    if (!_wtk_egl_init(display))
+        return 0;
+
+    if (pipe(_wtk.wayland.wakeup))
+        return 0;
+
+    for (int i = 0; i < 2; i++) {
+        fcntl(_wtk.wayland.wakeup[i], F_SETFL, fcntl(_wtk.wayland.wakeup[i], F_GETFL) | O_NONBLOCK);
+        fcntl(_wtk.wayland.wakeup[i], F_SETFD, FD_CLOEXEC);
+    }
+
+    return 1;
+}
+
+static void _wtk_quit(void) {
+    close(_wtk.wayland.wakeup[0]);
+    close(_wtk.wayland.wakeup[1]);
+    _wtk_egl_quit();
+
+    for (int i = 0; i < _WTK_MAX_MONITORS; i++)
+        if (_wtk.wayland.outputs[i].output)
+            _wtk_output_release(_wtk.wayland.outputs[i].output);
+
+    if (_wtk.wayland.pointer)    wl_pointer_destroy(_wtk.wayland.pointer);
+    if (_wtk.wayland.keyboard)   wl_keyboard_destroy(_wtk.wayland.keyboard);
+    if (_wtk.wayland.seat)       wl_seat_destroy(_wtk.wayland.seat);
+    if (_wtk.wayland.shm)        wl_shm_destroy(_wtk.wayland.shm);
+    if (_wtk.wayland.wm_base)    _wtk_xdg_destroy(_wtk.wayland.wm_base);
+    if (_wtk.wayland.compositor) wl_compositor_destroy(_wtk.wayland.compositor);
+    wl_registry_destroy(_wtk.wayland.registry);
+    wl_event_queue_destroy(_wtk.wayland.queue);
+    xkb_state_unref(_wtk.wayland.state);
+    xkb_keymap_unref(_wtk.wayland.keymap);
+    xkb_context_unref(_wtk.wayland.xkb);
+    wl_display_disconnect(_wtk.wayland.display);
+
+    // Every object is looked up by pointer, and the next wtk_window_create has to bind them all again
+    memset(&_wtk.wayland, 0, sizeof _wtk.wayland);
+}
+
+static void _wtk_xdg_surface_configure(void *data, struct xdg_surface *surface, uint32_t serial) {
+    wtk_window_t *window = data;
+    wl_proxy_marshal_flags((struct wl_proxy *)surface, _WTK_XDG_SURFACE_ACK_CONFIGURE, NULL, wl_proxy_get_version((struct wl_proxy *)surface), 0, serial);
+
+    // Compositors keep the last buffer around, so the only damage is having none yet or the wrong size
+    int w = window->pending_w, h = window->pending_h;
+    if (!window->configured)
+        _wtk_window_damage(window, (wtk_rect_t){0, 0, w > 0 ? w : window->desc.w, h > 0 ? h : window->desc.h});
+    window->configured = 1;
+
+    if (w <= 0 || h <= 0 || (w == window->desc.w && h == window->desc.h))
+        return;
+
+    // The compositor decides the size of a maximized, fullscreen or resized window
+    window->desc.w = w;
+    window->desc.h = h;
+    if (window->egl_window)
+        wl_egl_window_resize(window->egl_window, w, h, 0, 0);
+    _wtk_window_damage(window, (wtk_rect_t){0, 0, w, h});
+    window->resized++;
+    if (!window->desc.coalesce)
+        _wtk_post_configure(window);
+}
+
+static const _WtkXdgSurfaceListener _wtk_xdg_surface_listener = {
+    .configure = _wtk_xdg_surface_configure,
+};
+
+static void _wtk_toplevel_configure(void *data, struct xdg_toplevel *toplevel, int32_t w, int32_t h, struct wl_array *states) {
+    (void)toplevel; (void)states;
+    wtk_window_t *window = data;
+    window->pending_w = w;
+    window->pending_h = h;
+}
+
+static void _wtk_toplevel_close(void *data, struct xdg_toplevel *toplevel) {
+    (void)toplevel;
+    wtk_window_t *window = data;
+    wtk_window_set_closed(window, 1);
+    wtk_event_t event = {.type = WTK_EVENTTYPE_WINDOWCLOSE, .time_ns = _wtk.wayland.time};
+    _wtk_post_event(window, &event);
+}
+
+static const _WtkXdgToplevelListener _wtk_toplevel_listener = {
+    .configure = _wtk_toplevel_configure,
+    .close     = _wtk_toplevel_close,
+};
+
+static void _wtk_window_set_title(wtk_window_t *window, char const *title) {
+    struct wl_proxy *toplevel = (struct wl_proxy *)window->toplevel;
+    wl_proxy_marshal_flags(toplevel, _WTK_XDG_TOPLEVEL_SET_TITLE, NULL, wl_proxy_get_version(toplevel), 0, title);
+}
+
+static void _wtk_surface_enter(void *data, struct wl_surface *surface, struct wl_output *output) {
+    (void)surface;
+    wtk_window_t *window = data;
+    window->output = output;
+    window->frames.period_known = 0;
+}
+
+static void _wtk_surface_leave(void *data, struct wl_surface *surface, struct wl_output *output) {
+    (void)surface;
+    wtk_window_t *window = data;
+    if (window->output == output) {
+        window->output = NULL;
+        window->frames.period_known = 0;
+    }
+}
+
+static const struct wl_surface_listener _wtk_surface_listener = {
+    .enter = _wtk_surface_enter,
+    .leave = _wtk_surface_leave,
+};
+
+static int _wtk_window_create(wtk_window_t *window) {
+    window->motion.merged = -1;
+
+    if (!(window->window = wl_compositor_create_surface(_wtk.wayland.compositor)))
+        return 0;
+    wl_surface_add_listener(window->window, &_wtk_surface_listener, window);
+
+    struct wl_proxy *wm_base = (struct wl_proxy *)_wtk.wayland.wm_base;
+    window->xdg_surface = (struct xdg_surface *)wl_proxy_marshal_flags(wm_base, _WTK_XDG_WM_BASE_GET_XDG_SURFACE, &_wtk_xdg_surface_interface, wl_proxy_get_version(wm_base), 0, NULL, window->window);
+    if (!window->xdg_surface)
+        return 0;
+    wl_proxy_add_listener((struct wl_proxy *)window->xdg_surface, (void (**)(void))&_wtk_xdg_surface_listener, window);
+
+    struct wl_proxy *xdg_surface = (struct wl_proxy *)window->xdg_surface;
+    window->toplevel = (struct xdg_toplevel *)wl_proxy_marshal_flags(xdg_surface, _WTK_XDG_SURFACE_GET_TOPLEVEL, &_wtk_xdg_toplevel_interface, wl_proxy_get_version(xdg_surface), 0, NULL);
+    if (!window->toplevel)
+        return 0;
+    wl_proxy_add_listener((struct wl_proxy *)window->toplevel, (void (**)(void))&_wtk_toplevel_listener, window);
+    _wtk_window_set_title(window, window->desc.title);
+    window->swap_interval = 1;
+
+    // Nothing may be attached before the first configure is acked
+    wl_surface_commit(window->window);
+    while (!window->configured)
+        if (wl_display_dispatch(_wtk.wayland.display) < 0)
+            return 0;
+
+    return 1;
+}
+
+static int _wtk_window_create_context(wtk_window_t *window) {
+    // Shared contexts borrow a pbuffer when the display can't make them current without a surface
+    EGLint surface_type = EGL_WINDOW_BIT | (_wtk.egl.surfaceless ? 0 : EGL_PBUFFER_BIT);
+    if (!(window->config = _wtk_egl_choose_config(&window->desc.gl, surface_type)))
+        return 0;
+
+    if (!(window->egl_window = wl_egl_window_create(window->window, window->desc.w, window->desc.h)))
+        return 0;
+
+    EGLint attribs[4];
+    window->surface = eglCreateWindowSurface(_wtk.egl.display, window->config, (EGLNativeWindowType)window->egl_window, _wtk_egl_surface_attribs(window, attribs, 0));
+    if (window->surface == EGL_NO_SURFACE)
+        return 0;
+
+    if ((window->context = _wtk_egl_create_context(window->config, EGL_NO_CONTEXT, &window->desc.gl)) == EGL_NO_CONTEXT)
+        return 0;
+
+    // Swaps wait on frame callbacks themselves; left at 1, EGL would block on its own callback as well and
+    // stall for good once the window is hidden
+    EGLContext context = eglGetCurrentContext();
+    EGLSurface draw = eglGetCurrentSurface(EGL_DRAW), read = eglGetCurrentSurface(EGL_READ);
+    eglMakeCurrent(_wtk.egl.display, window->surface, window->surface, window->context);
+    eglSwapInterval(_wtk.egl.display, 0);
+    eglMakeCurrent(_wtk.egl.display, draw, read, context);
+    return 1;
+}
+
+static void _wtk_frame_done(void *data, struct wl_callback *callback, uint32_t time) {
+    (void)time;
+    wtk_window_t *window = data;
+    wl_callback_destroy(callback);
+    window->frame = NULL;
+}
+
+static const struct wl_callback_listener _wtk_frame_listener = {
+    .done = _wtk_frame_done,
+};
+
+static void _wtk_window_swap_buffers(wtk_window_t *window, wtk_rect_t const *rects, int n) {
+    if (window->swap_interval && window->frame) {
+        // The compositor says when it wants the next frame; until then another one would only be thrown away
+        uint64_t deadline = _wtk_time_ns() + _WTK_FRAME_TIMEOUT_NS;
+        for (uint64_t now = _wtk_time_ns(); window->frame && now < deadline; now = _wtk_time_ns())
+            if (_wtk_wayland_pump_queue((int)((deadline - now + 999999) / 1000000)) < 0)
+                break;
+
+        if (window->frame) {
+            wl_callback_destroy(window->frame);
+            window->frame = NULL;
+        }
+    }
+
+    // The callback has to be asked for before the swap commits. It goes on the private queue before the
+    // request is flushed, so the done event can't be dispatched from a user's wtk_poll_events
+    if (window->swap_interval) {
+        window->frame = wl_surface_frame(window->window);
+        wl_proxy_set_queue((struct wl_proxy *)window->frame, _wtk.wayland.queue);
+        wl_callback_add_listener(window->frame, &_wtk_frame_listener, window);
+    }
+
+    _wtk_egl_swap_buffers(window, rects, n);
+}
+
+static int _wtk_window_set_swap_interval(wtk_window_t *window, int interval) {
+    // Frame callbacks only say whether the compositor wants a frame, so any interval means every frame it asks for
+    (void)window;
+    return interval ? 1 : 0;
+}
+
+static void _wtk_poll_events(void) {
+    _wtk_wayland_read(NULL, 0, 0);
+    wl_display_dispatch_queue_pending(_wtk.wayland.display, _wtk.wayland.queue);
+    wl_display_dispatch_pending(_wtk.wayland.display);
+
+    // Coalesced motion and resizes are reported once everything read has been dispatched. A callback deleting
+    // windows restarts the walk, which only finds what's still pending
+    for (wtk_window_t *it = _wtk.window_list; it;) {
+        uint32_t deleted = _wtk.deleted;
+        _wtk_flush_motion(it);
+        if (deleted == _wtk.deleted)
+            _wtk_post_configure(it);
+        it = deleted == _wtk.deleted ? it->next : _wtk.window_list;
+    }
+
+    wl_display_flush(_wtk.wayland.display);
+}
+
+static void _wtk_wait_events(int64_t timeout) {
+    int ms = timeout < 0 ? -1 : timeout / 1000000 > 0x7fffffff ? 0x7fffffff : (int)((timeout + 999999) / 1000000);
+    _wtk_wayland_read(NULL, ms, 1);
+    _wtk_poll_events();
+}
+
+static void _wtk_post_empty_event(void) {
+    while (write(_wtk.wayland.wakeup[1], "", 1) < 0 && errno == EINTR)
+        ;
+}
+
+static int _wtk_input_thread_start(void) {
+    // Not implemented; events are already read off the socket by whichever thread waits
+    return 0;
+}
+
+static void _wtk_input_thread_stop(void) {
+}
+
+// shm_open with a throwaway name keeps to POSIX; the name is gone again before anyone else could open it
+static int _wtk_create_shm_file(size_t size) {
+    for (int tries = 0; tries < 16; tries++) {
+        char name[64];
+        snprintf(name, sizeof name, "/wtk-%d-%llu", (int)getpid(), (unsigned long long)_wtk_time_ns());
+
+        int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd < 0 && errno == EEXIST)
+            continue;
+        if (fd < 0)
+            return -1;
+
+        shm_unlink(name);
+        if (ftruncate(fd, (off_t)size) < 0) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+    return -1;
+}
+
+static void _wtk_buffer_release(void *data, struct wl_buffer *buffer) {
+    wtk_window_t *window = data;
+    for (int i = 0; i < 2; i++)
+        if (window->shm.buffer[i] == buffer)
+            window->shm.busy[i] = 0;
+}
+
+static const struct wl_buffer_listener _wtk_buffer_listener = {
+    .release = _wtk_buffer_release,
+};
+
+static void _wtk_destroy_shm(wtk_window_t *window) {
+    for (int i = 0; i < 2; i++)
+        if (window->shm.buffer[i])
+            wl_buffer_destroy(window->shm.buffer[i]);
+    if (window->shm.data)
+        munmap(window->shm.data, window->shm.size * 2);
+    memset(&window->shm, 0, sizeof window->shm);
+}
+
+static void *_wtk_window_map_pixels(wtk_window_t *window, int w, int h, int *stride) {
+    if (!window->shm.data || window->shm.w != w || window->shm.h != h) {
+        _wtk_destroy_shm(window);
+        if (!_wtk.wayland.shm)
+            return NULL;
+
+        size_t size = (size_t)w * h * 4;
+        int fd = _wtk_create_shm_file(size * 2);
+        if (fd < 0)
+            return NULL;
+
+        void *data = mmap(NULL, size * 2, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED) {
+            close(fd);
+            return NULL;
+        }
+
+        // Releases go on the private queue so waiting for one can't run user callbacks
+        struct wl_shm_pool *pool = wl_shm_create_pool(_wtk.wayland.shm, fd, (int32_t)(size * 2));
+        for (int i = 0; i < 2; i++) {
+            window->shm.buffer[i] = wl_shm_pool_create_buffer(pool, (int32_t)(size * i), w, h, w * 4, WL_SHM_FORMAT_XRGB8888);
+            wl_proxy_set_queue((struct wl_proxy *)window->shm.buffer[i], _wtk.wayland.queue);
+            wl_buffer_add_listener(window->shm.buffer[i], &_wtk_buffer_listener, window);
+        }
+        wl_shm_pool_destroy(pool);
+        close(fd);
+
+        window->shm.data = data;
+        window->shm.size = size;
+        window->shm.w = w;
+        window->shm.h = h;
+    }
+
+    // The compositor may still be reading this buffer from the present before last
+    int current = window->shm.current;
+    while (window->shm.busy[current])
+        if (_wtk_wayland_pump_queue(-1) < 0)
+            break;
+
+    *stride = w * 4;
+    return window->shm.data + window->shm.size * current;
+}
+
+static void _wtk_window_present_pixels(wtk_window_t *window, wtk_rect_t const *rects, int n, int preserve) {
+    int current = window->shm.current;
+    wl_surface_attach(window->window, window->shm.buffer[current], 0, 0);
+    for (int i = 0; i < n; i++) {
+        if (_wtk.wayland.compositor_version >= 4)
+            wl_surface_damage_buffer(window->window, rects[i].x, rects[i].y, rects[i].w, rects[i].h);
+        else
+            wl_surface_damage(window->window, rects[i].x, rects[i].y, rects[i].w, rects[i].h);
+    }
+    wl_surface_commit(window->window);
+    wl_display_flush(_wtk.wayland.display);
+
+    // Drawing continues in the other buffer while the compositor reads this one. Bring over
+    // what changed so it still holds the frame just presented
+    window->shm.busy[current] = 1;
+    window->shm.current = !current;
+
+    char *src = window->shm.data + window->shm.size * current, *dst = window->shm.data + window->shm.size * !current;
+    size_t pitch = (size_t)window->shm.w * 4;
+    for (int i = 0; preserve && i < n; i++)
+        for (int y = rects[i].y; y < rects[i].y + rects[i].h; y++)
+            memcpy(dst + y * pitch + rects[i].x * 4, src + y * pitch + rects[i].x * 4, (size_t)rects[i].w * 4);
+}
+
+static void _wtk_window_delete(wtk_window_t *window) {
+    if (_wtk.wayland.pointer_focus == window)
+        _wtk.wayland.pointer_focus = NULL;
+    if (_wtk.wayland.keyboard_focus == window)
+        _wtk.wayland.keyboard_focus = NULL;
+
+    if (window->frame)
+        wl_callback_destroy(window->frame);
+    _wtk_destroy_shm(window);
+    _wtk_egl_window_delete(window);
+    if (window->egl_window)
+        wl_egl_window_destroy(window->egl_window);
+    if (window->toplevel)
+        _wtk_xdg_destroy(window->toplevel);
+    if (window->xdg_surface)
+        _wtk_xdg_destroy(window->xdg_surface);
+    if (window->window)
+        wl_surface_destroy(window->window);
+    wl_display_flush(_wtk.wayland.display);
+}
+
+static void _wtk_window_set_pos(wtk_window_t *window, int x, int y) {
+    // Wayland clients can't place their windows
+    (void)window; (void)x; (void)y;
+}
+
+static void _wtk_window_set_size(wtk_window_t *window, int w, int h) {
+    if (window->egl_window)
+        wl_egl_window_resize(window->egl_window, w, h, 0, 0);
+    _wtk_window_damage(window, (wtk_rect_t){0, 0, w, h});
+}
+
+// There is no primary output on Wayland, the first one bound stands in
+static int _wtk_monitors_query(wtk_monitor_t *monitors, int cap) {
+    int count = 0;
+    for (int i = 0; i < _WTK_MAX_MONITORS && count < cap; i++) {
+        if (!_wtk.wayland.outputs[i].output || !_wtk.wayland.outputs[i].monitor.w)
+            continue;
+
+        monitors[count] = _wtk.wayland.outputs[i].monitor;
+        monitors[count].primary = count == 0;
+        count++;
+    }
+    return count;
+}
+
+static uintptr_t _wtk_window_monitor(wtk_window_t const *window) {
+    return (uintptr_t)window->output;
+}
+
+static wtk_native_t _wtk_window_native(wtk_window_t const *window) {
+    return (wtk_native_t){.display = _wtk.wayland.display, .window = (uintptr_t)window->window};
+}
+
+// }}}
+// Headless {{{
+
+#elif defined(WTK_API_HEADLESS)
+
+static uint64_t _wtk_time_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static int _wtk_init(void) {
+    PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+
+    // Prefer Mesa's surfaceless platform so no X server or GPU device node is needed
+    EGLDisplay display = EGL_NO_DISPLAY;
+    if (get_platform_display)
+        display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+    if (display == EGL_NO_DISPLAY)
+        display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+    if (!_wtk_egl_init(display))
+        return 0;
+
+    if (pipe(_wtk.headless.wakeup)) {
+        _wtk_egl_quit();
+        return 0;
+    }
+
+    for (int i = 0; i < 2; i++) {
+        fcntl(_wtk.headless.wakeup[i], F_SETFL, fcntl(_wtk.headless.wakeup[i], F_GETFL) | O_NONBLOCK);
+        fcntl(_wtk.headless.wakeup[i], F_SETFD, FD_CLOEXEC);
+    }
+
+    return 1;
+}
+
+static void _wtk_quit(void) {
+    close(_wtk.headless.wakeup[0]);
+    close(_wtk.headless.wakeup[1]);
+    _wtk_egl_quit();
+}
+
+static EGLSurface _wtk_create_pbuffer(wtk_window_t *window, int w, int h) {
+    EGLint attribs[8] = {EGL_WIDTH, w, EGL_HEIGHT, h};
+    return eglCreatePbufferSurface(_wtk.egl.display, window->config, _wtk_egl_surface_attribs(window, attribs, 4));
+}
+
+static int _wtk_window_create(wtk_window_t *window) {
+    window->window = ++_wtk.headless.next_id;
+
+    // Nothing maps the window, so the first poll reports it as exposed the way a display server would
+    _wtk_window_damage(window, (wtk_rect_t){0, 0, window->desc.w, window->desc.h});
+    return 1;
+}
+
+static int _wtk_window_create_context(wtk_window_t *window) {
+    if (!(window->config = _wtk_egl_choose_config(&window->desc.gl, EGL_PBUFFER_BIT)))
+        return 0;
+
+    if ((window->surface = _wtk_create_pbuffer(window, window->desc.w, window->desc.h)) == EGL_NO_SURFACE)
+        return 0;
+
+    window->context = _wtk_egl_create_context(window->config, EGL_NO_CONTEXT, &window->desc.gl);
+    return window->context != EGL_NO_CONTEXT;
+}
+
+static void _wtk_poll_events(void) {
+    // No input sources
+}
+
+static void _wtk_wait_events(int64_t timeout) {
+    struct pollfd fd = {.fd = _wtk.headless.wakeup[0], .events = POLLIN};
+
+    int ms = timeout < 0 ? -1 : timeout / 1000000 > 0x7fffffff ? 0x7fffffff : (int)((timeout + 999999) / 1000000);
+    while (poll(&fd, 1, ms) < 0 && errno == EINTR)
+        ;
+
+    if (fd.revents & POLLIN)
+        for (char buf[64]; read(_wtk.headless.wakeup[0], buf, sizeof buf) > 0;)
+            ;
+}
+
+static void _wtk_post_empty_event(void) {
+    while (write(_wtk.headless.wakeup[1], "", 1) < 0 && errno == EINTR)
+        ;
+}
+
+static int _wtk_input_thread_start(void) {
+    // No input to pump
+    return 0;
+}
+
+static void _wtk_input_thread_stop(void) {
+}
+
+static void *_wtk_window_map_pixels(wtk_window_t *window, int w, int h, int *stride) {
+    // Nothing to show the pixels on, they're only kept for the caller to read back
+    if (!window->pixels.data || window->pixels.w != w || window->pixels.h != h) {
+        free(window->pixels.data);
+        window->pixels.data = malloc((size_t)w * h * 4);
+    }
+
+    *stride = w * 4;
+    return window->pixels.data;
+}
+
+static void _wtk_window_present_pixels(wtk_window_t *window, wtk_rect_t const *rects, int n, int preserve) {
+    (void)window; (void)rects; (void)n; (void)preserve;
+}
+
+static void _wtk_window_delete(wtk_window_t *window) {
+    free(window->pixels.data);
+    _wtk_egl_window_delete(window);
+}
+
+static void _wtk_window_set_pos(wtk_window_t *window, int x, int y) {
+    (void)window; (void)x; (void)y;
+}
+
+static void _wtk_window_set_size(wtk_window_t *window, int w, int h) {
+    // Without a pbuffer yet there is nothing to resize, a lazy context gets one at the new size
+    if (window->surface) {
+        EGLSurface surface = _wtk_create_pbuffer(window, w, h);
+        if (surface == EGL_NO_SURFACE)
+            return;
+
+        if (eglGetCurrentContext() == window->context)
+            eglMakeCurrent(_wtk.egl.display, surface, surface, window->context);
+
+        eglDestroySurface(_wtk.egl.display, window->surface);
+        window->surface = surface;
+    }
+    _wtk_window_damage(window, (wtk_rect_t){0, 0, w, h});
+}
+
+static void _wtk_window_set_title(wtk_window_t *window, char const *title) {
+    (void)window; (void)title;
+}
+
+static int _wtk_monitors_query(wtk_monitor_t *monitors, int cap) {
+    (void)monitors; (void)cap;
+    return 0;
+}
+
+static uintptr_t _wtk_window_monitor(wtk_window_t const *window) {
+    (void)window;
+    return 0;
+}
+
+static wtk_native_t _wtk_window_native(wtk_window_t const *window) {
+    return (wtk_native_t){.window = window->window};
+}
+
+// }}}
+// Cocoa {{{
+
+#elif defined(WTK_API_COCOA)
+
+static uint64_t _wtk_time_ns(void) {
+    static mach_timebase_info_data_t timebase;
+    if (!timebase.denom)
+        mach_timebase_info(&timebase);
+    return mach_absolute_time() * timebase.numer / timebase.denom;
+}
+
+static int _wtk_translate_mods(NSEventModifierFlags flags) {
+    int mods = 0;
+
+    if (flags & NSEventModifierFlagControl)  mods |= WTK_MOD_CTRL;
+    if (flags & NSEventModifierFlagShift)    mods |= WTK_MOD_SHIFT;
+    if (flags & NSEventModifierFlagOption)   mods |= WTK_MOD_ALT;
+    if (flags & NSEventModifierFlagCommand)  mods |= WTK_MOD_SUPER;
+    if (flags & NSEventModifierFlagCapsLock) mods |= WTK_MOD_CAPSLOCK;
+
+    return mods;
+}
+
+static void _wtk_post_event(wtk_window_t *window, int type, NSEvent *event) {
+    wtk_event_t ev = {
+        .type       = type,
+        .mods       = _wtk_translate_mods([event modifierFlags]),
+        .location   = {(int)[event locationInWindow].x, (int)[event locationInWindow].y},
+        .delta      = {(int)[event deltaX], (int)[event deltaY]},
+        .time_ns    = (uint64_t)([event timestamp] * 1e9) // Seconds of uptime, the same clock as mach_absolute_time
+    };
+
+    if (type == WTK_EVENTTYPE_KEYDOWN || type == WTK_EVENTTYPE_KEYUP) {
+        ev.key = [event keyCode];
+        ev.repeat = type == WTK_EVENTTYPE_KEYDOWN && [event isARepeat];
+    } else if (type == WTK_EVENTTYPE_MOUSEDOWN || type == WTK_EVENTTYPE_MOUSEUP)
+        ev.button = [event buttonNumber];
+
+    _wtk_dispatch_event(window, &ev);
+}
+
+static float _wtk_flip_y(float y) {
+    return CGDisplayBounds(CGMainDisplayID()).size.height - y - 1;
+}
+
+@implementation _WtkCocoaApp
+- (void)applicationWillFinishLaunching:(NSNotification *)notification {
+    id menubar = [[NSMenu new] autorelease];
+    id appMenuItem = [[NSMenuItem new] autorelease];
+    id appMenu = [[NSMenu new] autorelease];
+    id appName = [[NSProcessInfo processInfo] processName];
+    id quitTitle = [@"Quit " stringByAppendingString:appName];
+    id quitMenuItem = [[[NSMenuItem alloc] initWithTitle:quitTitle action:@selector(terminate:) keyEquivalent:@"q"] autorelease];
+
+    [menubar addItem:appMenuItem];
+    [appMenu addItem:quitMenuItem];
+    [appMenuItem setSubmenu:appMenu];
+    [NSApp setMainMenu:menubar];
+}
+
+- (void)applicationDidChangeScreenParameters:(NSNotification *)notification {
+    _wtk_monitors_changed();
+}
+
+- (BOOL)applicationShouldTerminateAfterLastWindowClosed:(NSApplication *)sender {
+    return YES;
+}
+
+- (NSApplicationTerminateReply)applicationShouldTerminate:(NSApplication *)sender {
+    for (wtk_window_t *window = _wtk.window_list; window; window = window->next) {
+        wtk_window_set_closed(window, 1);
+        _wtk_dispatch_event(window, &(wtk_event_t){.type = WTK_EVENTTYPE_WINDOWCLOSE});
+    }
+
+    return NSTerminateCancel;
+}
+@end
+
+static NSOpenGLPixelFormat *_wtk_cocoa_choose_pixel_format(wtk_gl_desc_t *gl) {
+    // NSOpenGL has no debug or no-error contexts, and its framebuffers are always sRGB capable
+    gl->debug = gl->no_error = 0;
+
+    for (;;) {
+        NSOpenGLPixelFormatAttribute attributes[32], n = 0;
+        attributes[n++] = NSOpenGLPFAOpenGLProfile;
+        if (gl->profile == WTK_GL_PROFILE_COMPAT || gl->major * 10 + gl->minor < 32)
+            attributes[n++] = NSOpenGLProfileVersionLegacy;
+        else if (gl->major * 10 + gl->minor < 41)
+            attributes[n++] = NSOpenGLProfileVersion3_2Core;
+        else
+            attributes[n++] = NSOpenGLProfileVersion4_1Core;
+        attributes[n++] = NSOpenGLPFAAccelerated;
+        attributes[n++] = NSOpenGLPFADoubleBuffer;
+        attributes[n++] = NSOpenGLPFAColorSize;     attributes[n++] = 24;
+        attributes[n++] = NSOpenGLPFAAlphaSize;     attributes[n++] = 8;
+        attributes[n++] = NSOpenGLPFADepthSize;     attributes[n++] = gl->depth_bits;
+        attributes[n++] = NSOpenGLPFAStencilSize;   attributes[n++] = gl->stencil_bits;
+        if (gl->samples) {
+            attributes[n++] = NSOpenGLPFAMultisample;
+            attributes[n++] = NSOpenGLPFASampleBuffers; attributes[n++] = 1;
+            attributes[n++] = NSOpenGLPFASamples;       attributes[n++] = gl->samples;
+        }
+        attributes[n++] = 0;
+
+        NSOpenGLPixelFormat *format = [[[NSOpenGLPixelFormat alloc] initWithAttributes:attributes] autorelease];
+        if (format || !(_wtk_relax_pixel_format(gl) || _wtk_relax_context(gl)))
+            return format;
+    }
+}
+
+@implementation _WtkCocoaView {
+    wtk_window_t *m_window;
+}
+
+- (id)initWithFrame:(NSRect)frame window:(wtk_window_t *)window  {
+    // The view is handed out for a Metal layer instead, so it gets no pixel format to pick
+    if (window->desc.context == WTK_CONTEXT_NONE) {
+        if (self = [super initWithFrame:frame])
+            m_window = window;
+        return self;
+    }
+
+    NSOpenGLPixelFormat *format = _wtk_cocoa_choose_pixel_format(&window->desc.gl);
+    if (!format) {
+        [self release];
+        return nil;
+    }
+
+    if (self = [super initWithFrame:frame pixelFormat:format])
+        m_window = window;
+    return self;
+}
+
+- (BOOL)windowShouldClose:(NSNotification *)notification {
+    wtk_window_set_closed(m_window, 1);
+    _wtk_post_event(m_window, WTK_EVENTTYPE_WINDOWCLOSE, NULL);
+    return NO;
+}
+
+- (void)drawRect:(NSRect)rect {
+    // Cocoa's origin is the bottom left corner
+    int y = (int)([self bounds].size.height - rect.origin.y - rect.size.height);
+    _wtk_window_damage(m_window, (wtk_rect_t){(int)rect.origin.x, y, (int)rect.size.width, (int)rect.size.height});
+}
+
+- (void)keyDown:(NSEvent *)event         { _wtk_post_event(m_window, WTK_EVENTTYPE_KEYDOWN, event); }
 - (void)keyUp:(NSEvent *)event           { _wtk_post_event(m_window, WTK_EVENTTYPE_KEYUP, event); }
 - (void)mouseDown:(NSEvent *)event       { _wtk_post_event(m_window, WTK_EVENTTYPE_MOUSEDOWN, event); }
 - (void)mouseUp:(NSEvent *)event         { _wtk_post_event(m_window, WTK_EVENTTYPE_MOUSEUP, event);   }
@@ -693,223 +3989,1516 @@ static float _wtk_flip_y(float y) {
 - (void)mouseMoved:(NSEvent *)event      { _wtk_post_event(m_window, WTK_EVENTTYPE_MOUSEMOTION, event); }
 - (void)scrollWheel:(NSEvent *)event     { _wtk_post_event(m_window, WTK_EVENTTYPE_MOUSESCROLL, event); }
 
-@end
+@end
+
+int _wtk_init(void) {
+    @autoreleasepool {
+
+    [NSApplication sharedApplication];
+    _wtk.cocoa.app = [[_WtkCocoaApp alloc] init];
+
+    [NSApp setDelegate:_wtk.cocoa.app];
+    [NSApp setActivationPolicy:NSApplicationActivationPolicyRegular];
+    [NSApp activateIgnoringOtherApps:YES];
+    [NSApp finishLaunching];
+
+    return 1;
+
+    }
+}
+
+void _wtk_quit(void) {
+    @autoreleasepool {
+
+    [NSApp terminate:nil];
+    [_wtk.cocoa.app release];
+
+    }
+}
+
+int _wtk_window_create(wtk_window_t *window) {
+    @autoreleasepool {
+
+    unsigned styleMask = NSWindowStyleMaskMiniaturizable|NSWindowStyleMaskTitled|NSWindowStyleMaskClosable|NSWindowStyleMaskResizable;
+    NSRect frame = NSMakeRect(0, 0, window->desc.w, window->desc.h);
+
+    window->window = [[NSWindow alloc] initWithContentRect:frame styleMask:styleMask backing:NSBackingStoreBuffered defer:NO];
+    if (!window->window) return 0;
+
+    window->view = [[_WtkCocoaView alloc] initWithFrame:frame window:window];
+    if (!window->view) return 0;
+
+    [window->window setContentView:window->view];
+    [window->window setDelegate:window->view];
+    [window->window makeFirstResponder:window->view];
+    [window->window setAcceptsMouseMovedEvents:YES];
+    [window->window setRestorable:NO];
+    [window->window makeKeyAndOrderFront:nil];
+    [window->window center];
+
+    return 1;
+
+    }
+}
+
+int _wtk_window_create_context(wtk_window_t *window) {
+    @autoreleasepool {
+
+    // NSOpenGLView only creates its context the first time it's asked for it
+    return [window->view openGLContext] != nil;
+
+    }
+}
+
+void _wtk_window_make_current(wtk_window_t *window) {
+    @autoreleasepool {
+
+    [[window->view openGLContext] makeCurrentContext];
+
+    }
+}
+
+void _wtk_window_swap_buffers(wtk_window_t *window, wtk_rect_t const *rects, int n) {
+    (void)rects; (void)n;
+    @autoreleasepool {
+
+    [[window->view openGLContext] flushBuffer];
+
+    }
+}
+
+int _wtk_window_buffer_age(wtk_window_t const *window) {
+    (void)window;
+    return 0;
+}
+
+int _wtk_window_query_swap_interval(wtk_window_t *window) {
+    @autoreleasepool {
+
+    GLint value = 0;
+    [[window->view openGLContext] getValues:&value forParameter:NSOpenGLContextParameterSwapInterval];
+    return value;
+
+    }
+}
+
+int _wtk_window_set_swap_interval(wtk_window_t *window, int interval) {
+    @autoreleasepool {
+
+    // Cocoa only knows vsync on or off
+    GLint value = interval != 0;
+    [[window->view openGLContext] setValues:&value forParameter:NSOpenGLContextParameterSwapInterval];
+    [[window->view openGLContext] getValues:&value forParameter:NSOpenGLContextParameterSwapInterval];
+    return value;
+
+    }
+}
+
+void _wtk_poll_events(void) {
+    @autoreleasepool {
+
+    for (NSEvent *event; (event = [NSApp nextEventMatchingMask:NSEventMaskAny untilDate:nil inMode:NSDefaultRunLoopMode dequeue:YES]);)
+        [NSApp sendEvent:event];
+
+    }
+}
+
+void _wtk_wait_events(int64_t timeout) {
+    @autoreleasepool {
+
+    NSDate *until = timeout < 0 ? [NSDate distantFuture] : [NSDate dateWithTimeIntervalSinceNow:timeout / 1e9];
+    NSEvent *event = [NSApp nextEventMatchingMask:NSEventMaskAny untilDate:until inMode:NSDefaultRunLoopMode dequeue:YES];
+    if (event)
+        [NSApp sendEvent:event];
+
+    }
+
+    _wtk_poll_events();
+}
+
+void _wtk_post_empty_event(void) {
+    @autoreleasepool {
+
+    NSEvent *event = [NSEvent otherEventWithType:NSEventTypeApplicationDefined location:NSMakePoint(0, 0) modifierFlags:0 timestamp:0 windowNumber:0 context:nil subtype:0 data1:0 data2:0];
+    [NSApp postEvent:event atStart:YES];
+
+    }
+}
+
+int _wtk_input_thread_start(void) {
+    // AppKit only delivers events on the main thread
+    return 0;
+}
+
+void _wtk_input_thread_stop(void) {
+}
+
+int _wtk_context_create(wtk_context_t *context) {
+    @autoreleasepool {
+
+    NSOpenGLView *view = context->window->view;
+    context->context = [[NSOpenGLContext alloc] initWithFormat:[view pixelFormat] shareContext:[view openGLContext]];
+    return context->context != nil;
+
+    }
+}
+
+void _wtk_context_make_current(wtk_context_t *context) {
+    @autoreleasepool {
+
+    if (context)
+        [context->context makeCurrentContext];
+    else
+        [NSOpenGLContext clearCurrentContext];
+
+    }
+}
+
+void _wtk_context_delete(wtk_context_t *context) {
+    @autoreleasepool {
+
+    [context->context release];
+
+    }
+}
+
+void *_wtk_window_map_pixels(wtk_window_t *window, int w, int h, int *stride) {
+    if (!window->bitmap || (int)CGBitmapContextGetWidth(window->bitmap) != w || (int)CGBitmapContextGetHeight(window->bitmap) != h) {
+        CGContextRelease(window->bitmap);
+
+        // Same byte order as the other backends: B, G, R, X in memory
+        CGColorSpaceRef space = CGColorSpaceCreateDeviceRGB();
+        window->bitmap = CGBitmapContextCreate(NULL, w, h, 8, 0, space, kCGImageAlphaNoneSkipFirst | kCGBitmapByteOrder32Little);
+        CGColorSpaceRelease(space);
+        if (!window->bitmap)
+            return NULL;
+    }
+
+    *stride = (int)CGBitmapContextGetBytesPerRow(window->bitmap);
+    return CGBitmapContextGetData(window->bitmap);
+}
+
+void _wtk_window_present_pixels(wtk_window_t *window, wtk_rect_t const *rects, int n, int preserve) {
+    (void)rects; (void)n; (void)preserve;
+    @autoreleasepool {
+
+    // The GL view can't show layer contents, so the pixels get a layer-backed view on top of it
+    if (!window->pixels_view) {
+        window->pixels_view = [[NSView alloc] initWithFrame:[window->view bounds]];
+        [window->pixels_view setWantsLayer:YES];
+        [window->pixels_view setAutoresizingMask:NSViewWidthSizable | NSViewHeightSizable];
+        [window->view addSubview:window->pixels_view];
+    }
+
+    // The image shares the bitmap's memory copy-on-write, so drawing into the next frame never tears this one.
+    // Core Animation redraws the whole layer, there's no partial update to make
+    CGImageRef image = CGBitmapContextCreateImage(window->bitmap);
+    [[window->pixels_view layer] setContentsScale:[window->window backingScaleFactor]];
+    [[window->pixels_view layer] setContents:(id)image];
+    CGImageRelease(image);
+
+    }
+}
+
+void _wtk_window_delete(wtk_window_t *window) {
+    CGContextRelease(window->bitmap);
+    @autoreleasepool {
+
+    if (window->pixels_view)
+        [window->pixels_view release];
+    if (window->window) {
+        if (window->view)
+            [window->view release];
+        [window->window setDelegate:nil];
+        [window->window close];
+    }
+
+    }
+}
+
+void _wtk_window_pos(wtk_window_t const *window, int *x, int *y) {
+    @autoreleasepool {
+
+    CGPoint pos = [window->view frame].origin;
+    if (x) *x = pos.x;
+    if (y) *y = pos.y;
+
+    }
+}
+
+void _wtk_window_size(wtk_window_t const *window, int *w, int *h) {
+    @autoreleasepool {
+
+    CGSize size = [window->view frame].size;
+    if (w) *w = size.width;
+    if (h) *h = size.height;
+
+    }
+}
+
+void _wtk_window_fbsize(wtk_window_t const *window, int *w, int *h) {
+    @autoreleasepool {
+
+    CGSize size = [window->view convertRectToBacking:[window->view frame]].size;
+    if (w) *w = size.width;
+    if (h) *h = size.height;
+
+    }
+}
+
+void _wtk_window_set_pos(wtk_window_t *window, int x, int y) {
+    @autoreleasepool {
+
+    NSRect rect  = NSMakeRect(x, _wtk_flip_y(y + [window->view frame].size.height - 1), 0, 0);
+    NSRect frame = [window->window frameRectForContentRect:rect];
+    [window->window setFrameOrigin:frame.origin];
+
+    }
+}
+
+void _wtk_window_set_size(wtk_window_t *window, int w, int h) {
+    @autoreleasepool {
+
+    NSRect contentRect = [window->window contentRectForFrameRect:[window->window frame]];
+    contentRect.origin.y += contentRect.size.height - h;
+    contentRect.size = NSMakeSize(w, h);
+    [window->window setFrame:[window->window frameRectForContentRect:contentRect] display:YES];
+
+    }
+}
+
+void _wtk_window_set_title(wtk_window_t *window, char const *title) {
+    @autoreleasepool {
+
+    [window->window setTitle:@(title)];
+
+    }
+}
+
+static CGDirectDisplayID _wtk_screen_id(NSScreen *screen) {
+    return [[[screen deviceDescription] objectForKey:@"NSScreenNumber"] unsignedIntValue];
+}
+
+static int _wtk_monitors_query(wtk_monitor_t *monitors, int cap) {
+    @autoreleasepool {
+
+    // The first screen has the menu bar and the origin; y is flipped to grow downwards like everywhere else
+    NSArray *screens = [NSScreen screens];
+    CGFloat top = [screens count] ? NSMaxY([[screens objectAtIndex:0] frame]) : 0;
+
+    int count = 0;
+    for (NSScreen *screen in screens) {
+        if (count == cap)
+            break;
+
+        CGDirectDisplayID display = _wtk_screen_id(screen);
+        CGDisplayModeRef mode = CGDisplayCopyDisplayMode(display);
+        double hz = mode ? CGDisplayModeGetRefreshRate(mode) : 0;
+        CGDisplayModeRelease(mode);
+
+        // Built-in panels report no mode rate
+        if (hz <= 0 && [screen respondsToSelector:@selector(maximumFramesPerSecond)])
+            hz = (double)[screen maximumFramesPerSecond];
+
+        NSRect frame = [screen frame];
+        CGSize size = CGDisplayScreenSize(display);
+        wtk_monitor_t *monitor = &monitors[count];
+        *monitor = (wtk_monitor_t){
+            .id          = display,
+            .x           = (int)frame.origin.x,
+            .y           = (int)(top - NSMaxY(frame)),
+            .w           = (int)frame.size.width,
+            .h           = (int)frame.size.height,
+            .mm_w        = (int)size.width,
+            .mm_h        = (int)size.height,
+            .refresh_mhz = (int)(hz * 1000 + 0.5),
+            .scale       = (float)[screen backingScaleFactor],
+            .primary     = count == 0,
+        };
+        if ([screen respondsToSelector:@selector(localizedName)])
+            snprintf(monitor->name, sizeof monitor->name, "%s", [[screen localizedName] UTF8String]);
+        count++;
+    }
+    return count;
+
+    }
+}
+
+static uintptr_t _wtk_window_monitor(wtk_window_t const *window) {
+    @autoreleasepool {
+
+    NSScreen *screen = [window->window screen];
+    return screen ? _wtk_screen_id(screen) : 0;
+
+    }
+}
+
+static wtk_native_t _wtk_window_native(wtk_window_t const *window) {
+    return (wtk_native_t){.window = (uintptr_t)window->window, .view = window->view};
+}
+
+#endif // WTK_API_WIN32 || WTK_API_X11 || WTK_API_HEADLESS || WTK_API_COCOA
+
+// }}}
+// Common {{{
+
+static void _wtk_default_event_callback(wtk_window_t *window, wtk_event_t const *event) {
+    (void)window; (void)event;
+}
+
+static void _wtk_record_event(wtk_window_t *window, wtk_event_t const *event) {
+    // Native timestamps can predate wtk_record_begin by a little
+    _WtkRecord record = {
+        .time_ns = event->time_ns > _wtk.record.start ? event->time_ns - _wtk.record.start : 0,
+        .window  = window->id,
+        .type    = event->type,
+        .key     = event->key,
+        .button  = event->button,
+        .mods    = event->mods,
+        .x       = event->location.x,
+        .y       = event->location.y,
+        .dx      = event->delta.x,
+        .dy      = event->delta.y,
+        .merged  = event->merged,
+        .repeat  = event->repeat,
+        .w       = window->desc.w,
+        .h       = window->desc.h,
+    };
+
+    fwrite(&record, sizeof record, 1, _wtk.record.file);
+    _wtk.record.pending++;
+}
+
+static void _wtk_dispatch_event(wtk_window_t *window, wtk_event_t const *event) {
+    // A replay owns the input stream, live events would make it nondeterministic. Exposes and monitor changes aren't
+    // input: the real window still needs repainting, and the real monitors are what a replaying program runs on.
+    // Closing the real window still has to reach the program, or it couldn't be stopped until the log ran out
+    int state = event->type == WTK_EVENTTYPE_WINDOWEXPOSE || event->type == WTK_EVENTTYPE_MONITORCHANGE;
+    if (_wtk.replay.file && !_wtk.replay.feeding && !state && event->type != WTK_EVENTTYPE_WINDOWCLOSE)
+        return;
+
+    // Events without a native timestamp are stamped on delivery
+    wtk_event_t stamped;
+    if (!event->time_ns) {
+        stamped = *event;
+        stamped.time_ns = _wtk_time_ns();
+        event = &stamped;
+    }
+
+    if (_wtk.record.file && !state)
+        _wtk_record_event(window, event);
+
+    uint32_t *keys = window->input.keys, *buttons = &window->input.buttons;
+    switch (event->type) {
+        case WTK_EVENTTYPE_KEYDOWN:        if ((unsigned)event->key < 256) keys[event->key >> 5] |=  1u << (event->key & 31);  break;
+        case WTK_EVENTTYPE_KEYUP:          if ((unsigned)event->key < 256) keys[event->key >> 5] &= ~(1u << (event->key & 31)); break;
+        case WTK_EVENTTYPE_MOUSEDOWN:      if ((unsigned)event->button < 32) *buttons |=  1u << event->button;                 break;
+        case WTK_EVENTTYPE_MOUSEUP:        if ((unsigned)event->button < 32) *buttons &= ~(1u << event->button);               break;
+        case WTK_EVENTTYPE_WINDOWFOCUSOUT: memset(window->input.keys, 0, sizeof window->input.keys);                          break;
+        case WTK_EVENTTYPE_WINDOWMOVE:
+        case WTK_EVENTTYPE_MONITORCHANGE:  window->frames.period_known = 0;                                                   break;
+    }
+
+    _wtk.stats.events++;
+    if (!window->queue.events) {
+        window->desc.callback(window, event);
+        return;
+    }
+
+    // When the queue is full the oldest event is dropped so the latest state always wins
+    if (window->queue.head - window->queue.tail > window->queue.mask) {
+        window->queue.tail++;
+        _wtk.stats.dropped++;
+    }
+
+    window->queue.events[window->queue.head++ & window->queue.mask] = *event;
+}
+
+static int _wtk_queue_create(wtk_window_t *window) {
+    unsigned size = 1;
+    while (size < (unsigned)window->desc.queue_size)
+        size <<= 1;
+
+    window->queue.events = calloc(size, sizeof *window->queue.events);
+    window->queue.mask = size - 1;
+    return window->queue.events != NULL;
+}
+
+// Damage from the window system and wtk_window_request_redraw piles up here and goes out as one WINDOWEXPOSE at the
+// end of the poll, so a burst of exposes costs a single repaint
+static void _wtk_window_damage(wtk_window_t *window, wtk_rect_t rect) {
+    if (rect.w <= 0 || rect.h <= 0)
+        return;
+
+    int x0 = rect.x, y0 = rect.y, x1 = rect.x + rect.w, y1 = rect.y + rect.h;
+    if (window->expose.pending++) {
+        wtk_rect_t *bounds = &window->expose.rect;
+        x0 = x0 < bounds->x ? x0 : bounds->x;
+        y0 = y0 < bounds->y ? y0 : bounds->y;
+        x1 = x1 > bounds->x + bounds->w ? x1 : bounds->x + bounds->w;
+        y1 = y1 > bounds->y + bounds->h ? y1 : bounds->y + bounds->h;
+    }
+    window->expose.rect = (wtk_rect_t){x0, y0, x1 - x0, y1 - y0};
+}
+
+static int _wtk_expose_pending(void) {
+    for (wtk_window_t *it = _wtk.window_list; it; it = it->next)
+        if (it->expose.pending)
+            return 1;
+    return 0;
+}
+
+static void _wtk_flush_exposes(void) {
+    // Pending damage is cleared before it's dispatched, so restarting after a callback deleted windows is safe
+    for (wtk_window_t *it = _wtk.window_list, *next; it; it = next) {
+        next = it->next;
+        if (!it->expose.pending)
+            continue;
+
+        // The window may have shrunk since the damage was added
+        wtk_rect_t rect = it->expose.rect;
+        int x0 = rect.x > 0 ? rect.x : 0, x1 = rect.x + rect.w < it->desc.w ? rect.x + rect.w : it->desc.w;
+        int y0 = rect.y > 0 ? rect.y : 0, y1 = rect.y + rect.h < it->desc.h ? rect.y + rect.h : it->desc.h;
+        int merged = it->expose.pending - 1;
+        it->expose.pending = 0;
+        if (x1 <= x0 || y1 <= y0)
+            continue;
+
+        wtk_event_t event = {.type = WTK_EVENTTYPE_WINDOWEXPOSE, .rect = {x0, y0, x1 - x0, y1 - y0}, .merged = merged};
+        uint32_t deleted = _wtk.deleted;
+        _wtk_dispatch_event(it, &event);
+        next = deleted == _wtk.deleted ? it->next : _wtk.window_list;
+    }
+}
+
+// Headless has no monitors to change
+#if !defined(WTK_API_HEADLESS)
+static void _wtk_monitors_changed(void) {
+    _wtk.monitors.valid = 0;
+    _wtk.monitors.changed = 1;
+}
+#endif
+
+// A change usually arrives as a burst of native events, the windows hear about it once per poll
+static void _wtk_flush_monitors(void) {
+    if (!_wtk.monitors.changed)
+        return;
+
+    // Every window is marked first, so the walk can restart after a callback deleted windows without telling
+    // anyone twice, and windows created by a callback aren't told at all
+    _wtk.monitors.changed = 0;
+    for (wtk_window_t *it = _wtk.window_list; it; it = it->next)
+        it->monitor_changed = 1;
+
+    for (wtk_window_t *it = _wtk.window_list, *next; it; it = next) {
+        next = it->next;
+        if (!it->monitor_changed)
+            continue;
+
+        uint32_t deleted = _wtk.deleted;
+        it->monitor_changed = 0;
+        _wtk_dispatch_event(it, &(wtk_event_t){.type = WTK_EVENTTYPE_MONITORCHANGE});
+        next = deleted == _wtk.deleted ? it->next : _wtk.window_list;
+    }
+}
+
+static void _wtk_monitors_update(void) {
+    if (_wtk.monitors.valid)
+        return;
+
+    wtk_monitor_t *list = _wtk.monitors.list;
+    int count = _wtk_monitors_query(list, _WTK_MAX_MONITORS);
+    for (int i = 0; i < count; i++) {
+        list[i].period_ns = list[i].refresh_mhz > 0 ? 1000000000000ull / (uint64_t)list[i].refresh_mhz : 0;
+        if (list[i].primary && i) {
+            wtk_monitor_t primary = list[i];
+            list[i] = list[0];
+            list[0] = primary;
+        }
+    }
+
+    _wtk.monitors.count = count;
+    _wtk.monitors.valid = 1;
+}
+
+// The connection opens with the first window or monitor query and stays open until wtk_shutdown
+static int _wtk_lazy_init(void) {
+    if (_wtk.initialized)
+        return 1;
+
+    // Whatever the backend saw while connecting is the starting configuration, not a change
+    _wtk.initialized = _wtk_init();
+    _wtk.monitors.changed = 0;
+    return _wtk.initialized;
+}
+
+static unsigned _wtk_hash(uintptr_t handle) {
+    return (unsigned)(((uint64_t)handle * 0x9e3779b97f4a7c15ull) >> 32);
+}
+
+// Only backends whose events name native windows or surfaces look them up; Cocoa's views and headless know their window
+#if defined(WTK_API_WIN32) || defined(WTK_API_X11) || defined(WTK_API_WAYLAND)
+static wtk_window_t *_wtk_window_find(uintptr_t handle) {
+    if (_wtk.registry.last && _wtk.registry.last->handle == handle)
+        return _wtk.registry.last;
+
+    if (!_wtk.registry.slots)
+        return NULL;
+
+    for (unsigned i = _wtk_hash(handle) & _wtk.registry.mask;; i = (i + 1) & _wtk.registry.mask) {
+        wtk_window_t *window = _wtk.registry.slots[i];
+        if (!window || window->handle == handle)
+            return window ? (_wtk.registry.last = window) : NULL;
+    }
+}
+#endif
+
+static void _wtk_registry_put(wtk_window_t **slots, unsigned mask, wtk_window_t *window) {
+    unsigned i = _wtk_hash(window->handle) & mask;
+    while (slots[i])
+        i = (i + 1) & mask;
+    slots[i] = window;
+}
+
+static int _wtk_registry_insert(wtk_window_t *window) {
+    // Keep the load factor at or below 1/2 so probe sequences stay short
+    if ((_wtk.registry.count + 1) * 2 > _wtk.registry.mask + 1 || !_wtk.registry.slots) {
+        unsigned size = _wtk.registry.slots ? (_wtk.registry.mask + 1) * 2 : 16;
+        wtk_window_t **slots = calloc(size, sizeof *slots);
+        if (!slots) return 0;
+
+        for (unsigned i = 0; _wtk.registry.slots && i <= _wtk.registry.mask; i++)
+            if (_wtk.registry.slots[i])
+                _wtk_registry_put(slots, size - 1, _wtk.registry.slots[i]);
+
+        free(_wtk.registry.slots);
+        _wtk.registry.slots = slots;
+        _wtk.registry.mask = size - 1;
+    }
+
+    _wtk_registry_put(_wtk.registry.slots, _wtk.registry.mask, window);
+    _wtk.registry.count++;
+    return 1;
+}
+
+static void _wtk_registry_remove(wtk_window_t *window) {
+    if (_wtk.registry.last == window)
+        _wtk.registry.last = NULL;
+
+    if (!_wtk.registry.slots)
+        return;
+
+    unsigned i = _wtk_hash(window->handle) & _wtk.registry.mask;
+    for (; _wtk.registry.slots[i] != window; i = (i + 1) & _wtk.registry.mask)
+        if (!_wtk.registry.slots[i])
+            return;
+
+    _wtk.registry.slots[i] = NULL;
+    _wtk.registry.count--;
+
+    // Backward-shift the rest of the cluster so lookups never need tombstones
+    for (unsigned j = (i + 1) & _wtk.registry.mask; _wtk.registry.slots[j]; j = (j + 1) & _wtk.registry.mask) {
+        unsigned k = _wtk_hash(_wtk.registry.slots[j]->handle) & _wtk.registry.mask;
+        if ((j > i && (k <= i || k > j)) || (j < i && k <= i && k > j)) {
+            _wtk.registry.slots[i] = _wtk.registry.slots[j];
+            _wtk.registry.slots[j] = NULL;
+            i = j;
+        }
+    }
+}
+
+static wtk_window_t *_wtk_window_alloc(void) {
+    if (!_wtk.registry.free_list) {
+        _WtkSlab *slab = calloc(1, sizeof *slab);
+        if (!slab) return NULL;
+
+        slab->next = _wtk.registry.slabs;
+        _wtk.registry.slabs = slab;
+        for (int i = _WTK_SLAB_SIZE - 1; i >= 0; i--) {
+            slab->windows[i].next = _wtk.registry.free_list;
+            _wtk.registry.free_list = &slab->windows[i];
+        }
+    }
+
+    wtk_window_t *window = _wtk.registry.free_list;
+    _wtk.registry.free_list = window->next;
+    *window = (wtk_window_t){0};
+    return window;
+}
+
+static void _wtk_window_free(wtk_window_t *window) {
+    window->next = _wtk.registry.free_list;
+    _wtk.registry.free_list = window;
+}
+
+static void _wtk_registry_clear(void) {
+    while (_wtk.registry.slabs) {
+        _WtkSlab *next = _wtk.registry.slabs->next;
+        free(_wtk.registry.slabs);
+        _wtk.registry.slabs = next;
+    }
+
+    free(_wtk.registry.slots);
+    memset(&_wtk.registry, 0, sizeof _wtk.registry);
+}
+
+static void _wtk_validate_desc(wtk_window_t *window) {
+    if (!window->desc.callback) window->desc.callback = _wtk_default_event_callback;
+    if (!window->desc.title)    window->desc.title = "";
+    if (!window->desc.w)        window->desc.w = 640;
+    if (!window->desc.h)        window->desc.h = 480;
+    if (window->desc.queue_size < 0 || window->desc.queue_size > (1 << 20))
+        window->desc.queue_size = 0;
+    if (window->desc.context < WTK_CONTEXT_EAGER || window->desc.context > WTK_CONTEXT_NONE)
+        window->desc.context = WTK_CONTEXT_EAGER;
+
+    wtk_gl_desc_t *gl = &window->desc.gl;
+    if (gl->major <= 0) {
+        gl->major = _WTK_GL_MAJOR;
+        gl->minor = _WTK_GL_MINOR;
+    }
+    if (gl->samples < 0)    gl->samples = 0;
+    if (gl->debug)          gl->no_error = 0;
+    gl->depth_bits   = gl->depth_bits   < 0 ? 0 : gl->depth_bits   ? gl->depth_bits   : 24;
+    gl->stencil_bits = gl->stencil_bits < 0 ? 0 : gl->stencil_bits ? gl->stencil_bits : 8;
+}
+
+// A lazy context that fails to come up leaves the window without GL, rather than being retried on every call
+static int _wtk_window_gl(wtk_window_t *window) {
+    if (!window->gl && window->desc.context != WTK_CONTEXT_NONE) {
+        window->gl = _wtk_window_create_context(window);
+        if (!window->gl)
+            window->desc.context = WTK_CONTEXT_NONE;
+        else
+            window->swap_interval = _wtk_window_query_swap_interval(window);
+    }
+    return window->gl;
+}
+
+wtk_window_t *wtk_window_create(wtk_window_desc_t const *desc) {
+    if (!desc)
+        return NULL;
+
+    uint64_t start = _wtk_time_ns();
+
+    if (!_wtk_lazy_init())
+        return NULL;
+
+    wtk_window_t *window = _wtk_window_alloc();
+    if (!window)
+        return NULL;
+
+    window->frames.created_ns = start;
+    window->id = ++_wtk.next_window_id;
+    window->desc = *desc;
+    _wtk_validate_desc(window);
+
+    window->next = _wtk.window_list;
+    if (window->next)
+        window->next->prev = window;
+    _wtk.window_list = window;
+
+    if ((window->desc.queue_size && !_wtk_queue_create(window)) || !_wtk_window_create(window) ||
+        (window->desc.context == WTK_CONTEXT_EAGER && !_wtk_window_gl(window))) {
+        wtk_window_delete(window);
+        return NULL;
+    }
+
+    window->handle = (uintptr_t)window->window;
+    if (!_wtk_registry_insert(window)) {
+        wtk_window_delete(window);
+        return NULL;
+    }
+
+    _wtk.stats.windows_created++;
+    _wtk.stats.create_ns += _wtk_time_ns() - start;
+    return window;
+}
+
+void wtk_window_make_current(wtk_window_t *window) {
+    if (!window || !_wtk_window_gl(window)) return;
+
+    _wtk_window_make_current(window);
+    _wtk_current = window;
+}
+
+// The context shares objects with window and must be deleted before it. Each context may be current on one thread at a time
+wtk_context_t *wtk_context_create_shared(wtk_window_t *window) {
+    if (!window || !_wtk_window_gl(window)) return NULL;
+
+    wtk_context_t *context = calloc(1, sizeof *context);
+    if (!context) return NULL;
+
+    context->window = window;
+    if (!_wtk_context_create(context)) {
+        wtk_context_delete(context);
+        return NULL;
+    }
 
-int _wtk_init(void) {
-    @autoreleasepool {
+    return context;
+}
 
-    [NSApplication sharedApplication];
-    _wtk.cocoa.app = [[_WtkCocoaApp alloc] init];
+// Passing NULL releases whatever context is current on the calling thread
+void wtk_context_make_current(wtk_context_t *context) {
+    _wtk_context_make_current(context);
+    _wtk_current = context;
+}
 
-    [NSApp setDelegate:_wtk.cocoa.app];
-    [NSApp setActivationPolicy:NSApplicationActivationPolicyRegular];
-    [NSApp activateIgnoringOtherApps:YES];
-    [NSApp finishLaunching];
+void wtk_context_delete(wtk_context_t *context) {
+    if (!context) return;
 
-    return 1;
+    if (_wtk_current == context)
+        wtk_context_make_current(NULL);
 
-    }
+    _wtk_context_delete(context);
+    free(context);
 }
 
-void _wtk_quit(void) {
-    @autoreleasepool {
+void wtk_window_swap_buffers(wtk_window_t *window) {
+    wtk_window_swap_buffers_damage(window, NULL, 0);
+}
 
-    [NSApp terminate:nil];
-    [_wtk.cocoa.app release];
+// The rects, top-left origin, say what changed since the previous frame. Only EGL passes them on, and only with
+// EGL_KHR/EXT_swap_buffers_with_damage; GLX, WGL and NSOpenGL have no equivalent and do a full swap
+// Whether swap completions fill in present_ns and missed. Only GLX_INTEL_swap_event does; Mesa's DRI3, llvmpipe, EGL,
+// WGL and NSOpenGL leave it to _wtk_estimate_missed
+static int _wtk_presents_reported(void) {
+#if defined(WTK_API_X11) && !defined(_WTK_EGL)
+    return _wtk.x11.glx_swap_complete != 0;
+#else
+    return 0;
+#endif
+}
 
+// A synced swap returns on a vblank, so an interval that spans more vblanks than the swap interval asks for missed
+// the rest. Intervals jitter around whole periods and are rounded to the nearest
+static void _wtk_estimate_missed(wtk_window_t *window, wtk_frame_t *frame) {
+    uint64_t swap_interval = (uint64_t)(window->swap_interval < 0 ? -window->swap_interval : window->swap_interval);
+    if (!swap_interval || !frame->interval_ns)
+        return;
+
+    if (!window->frames.period_known) {
+        wtk_monitor_t monitor;
+        window->frames.period_ns = wtk_window_monitor(window, &monitor) ? monitor.period_ns : 0;
+        window->frames.period_known = 1;
+    }
+
+    if (!window->frames.period_ns)
+        return;
+
+    uint64_t vblanks = (frame->interval_ns + window->frames.period_ns / 2) / window->frames.period_ns;
+    if (vblanks > swap_interval) {
+        frame->missed = (uint32_t)(vblanks - swap_interval);
+        window->frames.missed += frame->missed;
     }
 }
 
-int _wtk_window_create(wtk_window_t *window) {
-    @autoreleasepool {
+void wtk_window_swap_buffers_damage(wtk_window_t *window, wtk_rect_t const *rects, int n) {
+    if (!window || !window->gl) return;
 
-    unsigned styleMask = NSWindowStyleMaskMiniaturizable|NSWindowStyleMaskTitled|NSWindowStyleMaskClosable|NSWindowStyleMaskResizable;
-    NSRect frame = NSMakeRect(0, 0, window->desc.w, window->desc.h);
+    uint64_t start = _wtk_time_ns();
+    _wtk_window_swap_buffers(window, rects, rects ? n : 0);
+    uint64_t end = _wtk_time_ns();
 
-    window->window = [[NSWindow alloc] initWithContentRect:frame styleMask:styleMask backing:NSBackingStoreBuffered defer:NO];
-    if (!window->window) return 0;
+    _wtk.stats.swaps++;
+    _wtk.stats.swap_ns += end - start;
 
-    window->view = [[_WtkCocoaView alloc] initWithFrame:frame window:window];
-    if (!window->view) return 0;
+    wtk_frame_t *frame = &window->frames.ring[window->frames.count++ % _WTK_FRAME_HISTORY];
+    *frame = (wtk_frame_t){
+        .start_ns    = start,
+        .swap_ns     = end - start,
+        .interval_ns = window->frames.last_end_ns ? end - window->frames.last_end_ns : 0,
+    };
+    window->frames.last_end_ns = end;
+    if (!window->frames.first_ns)
+        window->frames.first_ns = end;
 
-    [window->window setContentView:window->view];
-    [window->window setDelegate:window->view];
-    [window->window makeFirstResponder:window->view];
-    [window->window setAcceptsMouseMovedEvents:YES];
-    [window->window setRestorable:NO];
-    [window->window makeKeyAndOrderFront:nil];
-    [window->window center];
+    if (!_wtk_presents_reported())
+        _wtk_estimate_missed(window, frame);
+}
 
-    return 1;
+#if defined(WTK_API_X11) && !defined(_WTK_EGL)
+// Swap sbc (1 for the window's first) reached the screen at vblank msc. Completions arrive after the swap returned,
+// usually a frame or two later, and fill in the frame they belong to if it's still in the history
+static void _wtk_frame_presented(wtk_window_t *window, uint64_t sbc, uint64_t ust_ns, uint64_t msc) {
+    if (!sbc || sbc > window->frames.count || sbc <= window->frames.presented)
+        return;
+
+    // Any vblanks beyond the swap interval per frame since the last reported present were missed
+    uint64_t expected = (uint64_t)(window->swap_interval < 0 ? -window->swap_interval : window->swap_interval) * (sbc - window->frames.presented);
+    uint32_t missed = 0;
+    if (expected && window->frames.presented && msc > window->frames.msc + expected)
+        missed = (uint32_t)(msc - window->frames.msc - expected);
 
+    if (window->frames.count - sbc < _WTK_FRAME_HISTORY) {
+        wtk_frame_t *frame = &window->frames.ring[(sbc - 1) % _WTK_FRAME_HISTORY];
+        frame->present_ns = ust_ns;
+        frame->missed = missed;
     }
+
+    window->frames.presented = sbc;
+    window->frames.msc = msc;
+    window->frames.missed += missed;
 }
+#endif
 
-void _wtk_window_make_current(wtk_window_t *window) {
-    @autoreleasepool {
+static int _wtk_compare_u64(void const *a, void const *b) {
+    uint64_t x = *(uint64_t const *)a, y = *(uint64_t const *)b;
+    return (x > y) - (x < y);
+}
 
-    [[window->view openGLContext] makeCurrentContext];
+int wtk_window_frame_stats(wtk_window_t const *window, wtk_frame_stats_t *stats) {
+    if (!window || !stats) return 0;
 
+    *stats = (wtk_frame_stats_t){
+        .missed = window->frames.missed,
+        .first_frame_ns = window->frames.first_ns ? window->frames.first_ns - window->frames.created_ns : 0,
+    };
+    stats->frames = window->frames.count < _WTK_FRAME_HISTORY ? (int)window->frames.count : _WTK_FRAME_HISTORY;
+    if (!stats->frames)
+        return 0;
+
+    stats->last = window->frames.ring[(window->frames.count - 1) % _WTK_FRAME_HISTORY];
+
+    // The first frame has no interval, and a 0 would drag the percentiles down
+    uint64_t swap[_WTK_FRAME_HISTORY], interval[_WTK_FRAME_HISTORY];
+    int intervals = 0;
+    for (int i = 0; i < stats->frames; i++) {
+        swap[i] = window->frames.ring[i].swap_ns;
+        if (window->frames.ring[i].interval_ns)
+            interval[intervals++] = window->frames.ring[i].interval_ns;
     }
+
+    qsort(swap, (size_t)stats->frames, sizeof *swap, _wtk_compare_u64);
+    stats->swap_p50_ns = swap[stats->frames / 2];
+    stats->swap_p99_ns = swap[stats->frames * 99 / 100];
+    stats->swap_max_ns = swap[stats->frames - 1];
+
+    if (intervals) {
+        qsort(interval, (size_t)intervals, sizeof *interval, _wtk_compare_u64);
+        stats->interval_p50_ns = interval[intervals / 2];
+        stats->interval_p99_ns = interval[intervals * 99 / 100];
+        stats->interval_max_ns = interval[intervals - 1];
+    }
+    return stats->frames;
 }
 
-void _wtk_window_swap_buffers(wtk_window_t *window) {
-    @autoreleasepool {
+// Copies up to cap of the most recent frames, oldest first
+int wtk_window_frames(wtk_window_t const *window, wtk_frame_t *frames, int cap) {
+    if (!window || !frames || cap <= 0) return 0;
 
-    [[window->view openGLContext] flushBuffer];
+    unsigned n = window->frames.count < _WTK_FRAME_HISTORY ? window->frames.count : _WTK_FRAME_HISTORY;
+    if (n > (unsigned)cap)
+        n = (unsigned)cap;
 
-    }
+    for (unsigned i = 0; i < n; i++)
+        frames[i] = window->frames.ring[(window->frames.count - n + i) % _WTK_FRAME_HISTORY];
+    return (int)n;
 }
 
-void _wtk_poll_events(void) {
-    @autoreleasepool {
+// Negative intervals request adaptive vsync. Returns the interval the driver actually applied
+int wtk_window_set_swap_interval(wtk_window_t *window, int interval) {
+    if (!window) return 0;
+    if (!_wtk_window_gl(window)) return window->swap_interval;
 
-    for (NSEvent *event; (event = [NSApp nextEventMatchingMask:NSEventMaskAny untilDate:nil inMode:NSDefaultRunLoopMode dequeue:YES]);)
-        [NSApp sendEvent:event];
+    window->swap_interval = _wtk_window_set_swap_interval(window, interval);
+    return window->swap_interval;
+}
 
-    }
+// What the driver started the context with until an interval is set, 0 while the window has no context. WGL without
+// wglGetSwapIntervalEXT and GLX without a swap control extension can't be asked, there 0 means unknown
+int wtk_window_swap_interval(wtk_window_t const *window) {
+    return window ? window->swap_interval : 0;
 }
 
-void _wtk_window_delete(wtk_window_t *window) {
-    @autoreleasepool {
+// How many frames ago the back buffer was last drawn: 1 means it holds the previous frame, 0 means unknown contents.
+// Only valid while window is current
+int wtk_window_buffer_age(wtk_window_t const *window) {
+    return window && window->gl ? _wtk_window_buffer_age(window) : 0;
+}
 
-    if (window->window) {
-        if (window->view)
-            [window->view release];
-        [window->window setDelegate:nil];
-        [window->window close];
-    }
+static void _wtk_replay_end(void) {
+    if (_wtk.replay.file)
+        fclose(_wtk.replay.file);
+    _wtk.replay.file = NULL;
+}
+
+// Dispatches whatever the log has due and returns how long a wait may block before the next record is
+static int64_t _wtk_replay_feed(int64_t timeout) {
+    uint64_t now = _wtk_time_ns();
+    int fed = 0;
+
+    _wtk.replay.feeding = 1;
+    while (_wtk.replay.file) {
+        _WtkRecord *record = &_wtk.replay.next;
+        uint64_t due = _wtk.replay.start + record->time_ns;
+        if (_wtk.replay.realtime && due > now) {
+            if (timeout < 0 || (uint64_t)timeout > due - now)
+                timeout = (int64_t)(due - now);
+            break;
+        }
+
+        // Without realtime each poll gets one recorded batch, with it markers carry no meaning
+        int marker = !record->window;
+        for (wtk_window_t *window = _wtk.window_list; window && !marker; window = window->next) {
+            if (window->id != record->window)
+                continue;
+
+            wtk_event_t event = {
+                .type     = record->type,
+                .key      = record->key,
+                .button   = record->button,
+                .mods     = record->mods,
+                .location = {record->x, record->y},
+                .delta    = {record->dx, record->dy},
+                .merged   = record->merged,
+                .repeat   = record->repeat,
+                .time_ns  = due,
+            };
+
+            // Geometry events carry the state they report, which the live ones being dropped no longer update
+            if (event.type == WTK_EVENTTYPE_WINDOWCLOSE) {
+                wtk_window_set_closed(window, 1);
+            } else if (event.type == WTK_EVENTTYPE_WINDOWMOVE) {
+                window->x = record->x;
+                window->y = record->y;
+            } else if (event.type == WTK_EVENTTYPE_WINDOWRESIZE) {
+                window->desc.w = record->w;
+                window->desc.h = record->h;
+            }
+            _wtk_dispatch_event(window, &event);
+            fed = 1;
+            break;
+        }
+
+        if (fread(record, sizeof *record, 1, _wtk.replay.file) != 1) {
+            _wtk_replay_end();
+            fed = 1;
+        }
 
+        if (marker && !_wtk.replay.realtime)
+            break;
     }
+    _wtk.replay.feeding = 0;
+
+    return fed ? 0 : timeout;
 }
 
-void _wtk_window_pos(wtk_window_t const *window, int *x, int *y) {
-    @autoreleasepool {
+static void _wtk_pump_events(int64_t timeout) {
+    if (!_wtk.initialized)
+        return;
 
-    CGPoint pos = [window->view frame].origin;
-    if (x) *x = pos.x;
-    if (y) *y = pos.y;
+    if (_wtk.replay.file)
+        timeout = _wtk_replay_feed(timeout);
+
+    // Requested redraws are due at the end of this poll, so there is nothing to wait for
+    if (timeout && _wtk_expose_pending())
+        timeout = 0;
 
+    if (timeout)
+        _wtk_wait_events(timeout);
+    else
+        _wtk_poll_events();
+
+    if (_wtk.replay.file && _wtk.replay.realtime)
+        _wtk_replay_feed(0);
+
+    _wtk_flush_exposes();
+    _wtk_flush_monitors();
+
+    // Marking batch boundaries lets a replay that runs as fast as possible still see the same polls
+    if (_wtk.record.file && _wtk.record.pending) {
+        _WtkRecord marker = {.time_ns = _wtk_time_ns() - _wtk.record.start};
+        fwrite(&marker, sizeof marker, 1, _wtk.record.file);
+        _wtk.record.pending = 0;
     }
 }
 
-void _wtk_window_size(wtk_window_t const *window, int *w, int *h) {
-    @autoreleasepool {
+void wtk_poll_events(void) {
+    uint64_t start = _wtk_time_ns();
+    _wtk_pump_events(0);
+    _wtk.stats.polls++;
+    _wtk.stats.poll_ns += _wtk_time_ns() - start;
+}
 
-    CGSize size = [window->view frame].size;
-    if (w) *w = size.width;
-    if (h) *h = size.height;
+void wtk_wait_events(void) {
+    _wtk_pump_events(-1);
+}
 
-    }
+void wtk_wait_events_timeout(uint64_t ns) {
+    _wtk_pump_events(ns > INT64_MAX ? INT64_MAX : (int64_t)ns);
 }
 
-void _wtk_window_fbsize(wtk_window_t const *window, int *w, int *h) {
-    @autoreleasepool {
+void wtk_post_empty_event(void) {
+    if (_wtk.initialized)
+        _wtk_post_empty_event();
+}
 
-    CGSize size = [window->view convertRectToBacking:[window->view frame]].size;
-    if (w) *w = size.width;
-    if (h) *h = size.height;
+// Handles events while it sleeps, which a frame about to poll would do anyway
+static void _wtk_sleep_until(uint64_t deadline) {
+    for (uint64_t now; (now = _wtk_time_ns()) < deadline;)
+        if (deadline - now > _WTK_SPIN_NS)
+            wtk_wait_events_timeout(deadline - now - _WTK_SPIN_NS);
+}
+
+// Polls, updates, renders and swaps until the window is closed. Each frame owns a slot: frame_ns long when set,
+// otherwise from one swap returning to the next. Without late_latch a frame starts at the beginning of its slot,
+// with it as late as the slowest recent frame still fits before the end
+void wtk_run(wtk_window_t *window, void (*frame)(wtk_window_t *window, wtk_tick_t const *tick, void *user), wtk_run_desc_t const *desc) {
+    if (!window || !frame) return;
+
+    wtk_run_desc_t run = desc ? *desc : (wtk_run_desc_t){0};
+    int max_steps = run.max_steps > 0 ? run.max_steps : 8;
+
+    wtk_tick_t tick = {0};
+    uint64_t slot = 0, period = run.frame_ns, accumulator = 0;
+    uint64_t work[_WTK_LATCH_HISTORY] = {0};
+
+    while (!wtk_window_closed(window)) {
+        uint64_t now = _wtk_time_ns();
+        if (run.frame_ns) {
+            // A frame that overran its slot moves the schedule instead of rushing the ones after it
+            slot = slot ? slot + run.frame_ns : now;
+            if (now > slot + run.frame_ns)
+                slot = now;
+        } else {
+            slot = now;
+
+            // On vsync the slot is the refresh period, which the swaps measure
+            wtk_frame_stats_t stats;
+            if (run.late_latch && !(tick.frame % _WTK_LATCH_HISTORY) && wtk_window_frame_stats(window, &stats) && stats.frames >= _WTK_LATCH_HISTORY)
+                period = stats.interval_p50_ns;
+        }
+
+        uint64_t start = slot;
+        if (run.late_latch && period && tick.frame >= _WTK_LATCH_HISTORY) {
+            uint64_t budget = 0;
+            for (int i = 0; i < _WTK_LATCH_HISTORY; i++)
+                budget = work[i] > budget ? work[i] : budget;
+            budget += budget / 4 + _WTK_LATCH_MARGIN_NS;
+            if (budget < period)
+                start += period - budget;
+        }
+        _wtk_sleep_until(start);
+
+        wtk_poll_events();
+        if (wtk_window_closed(window))
+            break;
+
+        now = _wtk_time_ns();
+        tick.dt_ns = tick.time_ns ? now - tick.time_ns : 0;
+        tick.time_ns = now;
+
+        if (run.step_ns && run.update) {
+            accumulator += tick.dt_ns;
+            if (accumulator > (uint64_t)max_steps * run.step_ns)
+                accumulator = (uint64_t)max_steps * run.step_ns;
+            for (; accumulator >= run.step_ns; accumulator -= run.step_ns)
+                run.update(window, run.step_ns, run.user);
+            tick.alpha = (double)accumulator / (double)run.step_ns;
+        }
+
+        frame(window, &tick, run.user);
 
+        // Timed before the swap, which may block on vblank whatever interval the driver defaults to
+        work[tick.frame++ % _WTK_LATCH_HISTORY] = _wtk_time_ns() - now;
+        wtk_window_swap_buffers(window);
     }
 }
 
-void _wtk_window_set_pos(wtk_window_t *window, int x, int y) {
-    @autoreleasepool {
+// Moves reading the display connection onto a wtk-owned thread that timestamps events as they arrive.
+// wtk_poll_events/wtk_wait_events then only drain what it has queued. While its queue is full the thread stops
+// reading until a poll makes room, so input is throttled rather than dropped. Needs a window to have been created;
+// X11 only
+int wtk_input_thread_start(void) {
+    return _wtk.initialized ? _wtk_input_thread_start() : 0;
+}
 
-    NSRect rect  = NSMakeRect(x, _wtk_flip_y(y + [window->view frame].size.height - 1), 0, 0);
-    NSRect frame = [window->window frameRectForContentRect:rect];
-    [window->window setFrameOrigin:frame.origin];
+void wtk_input_thread_stop(void) {
+    if (_wtk.initialized)
+        _wtk_input_thread_stop();
+}
+
+// Appends every event delivered from now on to path. Windows are identified by creation order,
+// so a replaying program has to create its windows in the same order
+int wtk_record_begin(char const *path) {
+    wtk_record_end();
+    if (!path || !(_wtk.record.file = fopen(path, "wb")))
+        return 0;
 
+    _WtkRecordHeader header = {_WTK_RECORD_MAGIC, _WTK_RECORD_VERSION, sizeof(_WtkRecord), 0};
+    if (fwrite(&header, sizeof header, 1, _wtk.record.file) != 1) {
+        wtk_record_end();
+        return 0;
     }
+
+    _wtk.record.start = _wtk_time_ns();
+    _wtk.record.pending = 0;
+    return 1;
 }
 
-void _wtk_window_set_size(wtk_window_t *window, int w, int h) {
-    @autoreleasepool {
+void wtk_record_end(void) {
+    if (_wtk.record.file)
+        fclose(_wtk.record.file);
+    _wtk.record.file = NULL;
+}
 
-    NSRect contentRect = [window->window contentRectForFrameRect:[window->window frame]];
-    contentRect.origin.y += contentRect.size.height - h;
-    contentRect.size = NSMakeSize(w, h);
-    [window->window setFrame:[window->window frameRectForContentRect:contentRect] display:YES];
+// Feeds a recorded log through the usual callback or queue from the following polls, in place of live input.
+// With realtime the original timing is kept, otherwise each poll delivers the next recorded batch
+int wtk_replay(char const *path, int realtime) {
+    _wtk_replay_end();
+    if (!path || !(_wtk.replay.file = fopen(path, "rb")))
+        return 0;
 
+    _WtkRecordHeader header;
+    if (fread(&header, sizeof header, 1, _wtk.replay.file) != 1 ||
+        header.magic != _WTK_RECORD_MAGIC || header.version != _WTK_RECORD_VERSION || header.record_size != sizeof(_WtkRecord) ||
+        fread(&_wtk.replay.next, sizeof _wtk.replay.next, 1, _wtk.replay.file) != 1) {
+        _wtk_replay_end();
+        return 0;
     }
+
+    _wtk.replay.start = _wtk_time_ns();
+    _wtk.replay.realtime = realtime;
+    return 1;
 }
 
-void _wtk_window_set_title(wtk_window_t *window, char const *title) {
-    @autoreleasepool {
+// Nonzero until every record of the log has been delivered
+int wtk_replaying(void) {
+    return _wtk.replay.file != NULL;
+}
 
-    [window->window setTitle:@(title)];
+// The monotonic clock behind event and frame timestamps
+uint64_t wtk_time_ns(void) {
+    return _wtk_time_ns();
+}
+
+void wtk_stats(wtk_stats_t *stats) {
+    if (stats)
+        *stats = _wtk.stats;
+}
+
+// Returns the window's backbuffer as 32-bit 0xXXRRGGBB pixels, top row first, rows stride bytes apart, sized to
+// wtk_window_fbsize. Map again after every present; the buffer keeps the last presented frame unless it was presented whole
+void *wtk_window_map_pixels(wtk_window_t *window, int *stride) {
+    if (!window) return NULL;
+
+    int w, h, pitch = 0;
+    wtk_window_fbsize(window, &w, &h);
+    if (w <= 0 || h <= 0)
+        return NULL;
+
+    window->pixels.data = _wtk_window_map_pixels(window, w, h, &pitch);
+    window->pixels.w = window->pixels.data ? w : 0;
+    window->pixels.h = window->pixels.data ? h : 0;
+    window->pixels.stride = pitch;
+    if (stride)
+        *stride = pitch;
+    return window->pixels.data;
+}
+
+// Shows the mapped buffer without touching GL. Passing the changed rects limits the copy to them; NULL presents everything
+void wtk_window_present_pixels(wtk_window_t *window, wtk_rect_t const *rects, int n) {
+    if (!window || !window->pixels.data) return;
+
+    wtk_rect_t full = {0, 0, window->pixels.w, window->pixels.h}, clipped[_WTK_MAX_RECTS];
+    if (!rects || n <= 0 || n > _WTK_MAX_RECTS) {
+        _wtk_window_present_pixels(window, &full, 1, rects != NULL);
+        return;
+    }
 
+    int count = 0;
+    for (int i = 0; i < n; i++) {
+        int x0 = rects[i].x < 0 ? 0 : rects[i].x, x1 = rects[i].x + rects[i].w > full.w ? full.w : rects[i].x + rects[i].w;
+        int y0 = rects[i].y < 0 ? 0 : rects[i].y, y1 = rects[i].y + rects[i].h > full.h ? full.h : rects[i].y + rects[i].h;
+        if (x0 < x1 && y0 < y1)
+            clipped[count++] = (wtk_rect_t){x0, y0, x1 - x0, y1 - y0};
     }
+
+    if (count)
+        _wtk_window_present_pixels(window, clipped, count, 1);
 }
 
-#endif // WTK_API_WIN32 || WTK_API_X11 || WTK_API_COCOA
+// Pixel conversion kernels turn n source pixels into the BGRX layout of the mapped buffer
+typedef void _WtkConvertProc(uint32_t *dst, void const *src, int n);
 
-// }}}
-// Common {{{
+static void _wtk_convert_bgrx8(uint32_t *dst, void const *src, int n) {
+    memcpy(dst, src, (size_t)n * 4);
+}
 
-static void _wtk_default_event_callback(wtk_window_t *window, wtk_event_t const *event) {
-    (void)window; (void)event;
+static void _wtk_convert_rgba8(uint32_t *dst, void const *src, int n) {
+    uint8_t const *s = src;
+    for (int i = 0; i < n; i++, s += 4)
+        dst[i] = 0xff000000u | (uint32_t)s[0] << 16 | (uint32_t)s[1] << 8 | s[2];
 }
 
-static void _wtk_validate_desc(wtk_window_t *window) {
-    if (!window->desc.callback) window->desc.callback = _wtk_default_event_callback;
-    if (!window->desc.title)    window->desc.title = "";
-    if (!window->desc.w)        window->desc.w = 640;
-    if (!window->desc.h)        window->desc.h = 480;
+static uint32_t _wtk_unorm8(float f) {
+    // Written so NaN lands on 0
+    return !(f > 0.0f) ? 0 : f >= 1.0f ? 255 : (uint32_t)(f * 255.0f + 0.5f);
 }
 
-wtk_window_t *wtk_window_create(wtk_window_desc_t const *desc) {
-    if (!desc)
-        return NULL;
+static void _wtk_convert_rgba32f(uint32_t *dst, void const *src, int n) {
+    float const *s = src;
+    for (int i = 0; i < n; i++, s += 4)
+        dst[i] = 0xff000000u | _wtk_unorm8(s[0]) << 16 | _wtk_unorm8(s[1]) << 8 | _wtk_unorm8(s[2]);
+}
 
-    if (!_wtk.window_list)
-        if (!_wtk_init())
-            return NULL;
+#if defined(_WTK_SSE2)
+static __m128i _wtk_swizzle_sse2(__m128i rgba) {
+    __m128i g  = _mm_and_si128(rgba, _mm_set1_epi32(0x0000ff00));
+    __m128i r  = _mm_slli_epi32(_mm_and_si128(rgba, _mm_set1_epi32(0xff)), 16);
+    __m128i b  = _mm_and_si128(_mm_srli_epi32(rgba, 16), _mm_set1_epi32(0xff));
+    return _mm_or_si128(_mm_or_si128(r, g), _mm_or_si128(b, _mm_set1_epi32((int)0xff000000)));
+}
 
-    wtk_window_t *window = calloc(1, sizeof *window);
-    if (!window) return NULL;
+static void _wtk_convert_rgba8_sse2(uint32_t *dst, void const *src, int n) {
+    uint32_t const *s = src;
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+        _mm_storeu_si128((__m128i *)(dst + i), _wtk_swizzle_sse2(_mm_loadu_si128((__m128i const *)(s + i))));
+    _wtk_convert_rgba8(dst + i, s + i, n - i);
+}
 
-    window->desc = *desc;
-    _wtk_validate_desc(window);
+static __m128i _wtk_unorm8_sse2(__m128 v) {
+    // max/min return the second operand on NaN, which clamps it to 0
+    v = _mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+    return _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(v, _mm_set1_ps(255.0f)), _mm_set1_ps(0.5f)));
+}
 
-    if (!_wtk_window_create(window)) {
-        wtk_window_delete(window);
-        return NULL;
+static void _wtk_convert_rgba32f_sse2(uint32_t *dst, void const *src, int n) {
+    float const *s = src;
+    int i = 0;
+    for (; i + 4 <= n; i += 4, s += 16) {
+        __m128i lo = _mm_packs_epi32(_wtk_unorm8_sse2(_mm_loadu_ps(s + 0)), _wtk_unorm8_sse2(_mm_loadu_ps(s + 4)));
+        __m128i hi = _mm_packs_epi32(_wtk_unorm8_sse2(_mm_loadu_ps(s + 8)), _wtk_unorm8_sse2(_mm_loadu_ps(s + 12)));
+        _mm_storeu_si128((__m128i *)(dst + i), _wtk_swizzle_sse2(_mm_packus_epi16(lo, hi)));
     }
+    _wtk_convert_rgba32f(dst + i, s, n - i);
+}
+#endif
 
-    window->next = _wtk.window_list;
-    _wtk.window_list = window;
+#if defined(_WTK_AVX2)
+__attribute__((target("avx2")))
+static __m256i _wtk_swizzle_avx2(__m256i rgba) {
+    __m256i order = _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+                                     2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+    return _mm256_or_si256(_mm256_shuffle_epi8(rgba, order), _mm256_set1_epi32((int)0xff000000));
+}
 
-    return window;
+__attribute__((target("avx2")))
+static void _wtk_convert_rgba8_avx2(uint32_t *dst, void const *src, int n) {
+    uint32_t const *s = src;
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+        _mm256_storeu_si256((__m256i *)(dst + i), _wtk_swizzle_avx2(_mm256_loadu_si256((__m256i const *)(s + i))));
+    _wtk_convert_rgba8(dst + i, s + i, n - i);
 }
 
-void wtk_window_make_current(wtk_window_t *window) {
-    if (window)
-        _wtk_window_make_current(window);
+__attribute__((target("avx2")))
+static __m256i _wtk_unorm8_avx2(__m256 v) {
+    v = _mm256_min_ps(_mm256_max_ps(v, _mm256_setzero_ps()), _mm256_set1_ps(1.0f));
+    return _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(v, _mm256_set1_ps(255.0f)), _mm256_set1_ps(0.5f)));
 }
 
-void wtk_window_swap_buffers(wtk_window_t *window) {
-    if (window)
-        _wtk_window_swap_buffers(window);
+__attribute__((target("avx2")))
+static void _wtk_convert_rgba32f_avx2(uint32_t *dst, void const *src, int n) {
+    float const *s = src;
+    int i = 0;
+    for (; i + 8 <= n; i += 8, s += 32) {
+        // Packing works within 128-bit lanes, which leaves the pixels in 0 2 4 6 1 3 5 7 order
+        __m256i lo = _mm256_packs_epi32(_wtk_unorm8_avx2(_mm256_loadu_ps(s + 0)),  _wtk_unorm8_avx2(_mm256_loadu_ps(s + 8)));
+        __m256i hi = _mm256_packs_epi32(_wtk_unorm8_avx2(_mm256_loadu_ps(s + 16)), _wtk_unorm8_avx2(_mm256_loadu_ps(s + 24)));
+        __m256i px = _mm256_permutevar8x32_epi32(_mm256_packus_epi16(lo, hi), _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+        _mm256_storeu_si256((__m256i *)(dst + i), _wtk_swizzle_avx2(px));
+    }
+    _wtk_convert_rgba32f(dst + i, s, n - i);
 }
+#endif
 
-void wtk_poll_events(void) {
-    _wtk_poll_events();
+#if defined(_WTK_NEON)
+static void _wtk_convert_rgba8_neon(uint32_t *dst, void const *src, int n) {
+    uint8_t const *s = src;
+    int i = 0;
+    for (; i + 16 <= n; i += 16, s += 64) {
+        uint8x16x4_t rgba = vld4q_u8(s);
+        uint8x16x4_t bgrx = {{rgba.val[2], rgba.val[1], rgba.val[0], vdupq_n_u8(0xff)}};
+        vst4q_u8((uint8_t *)(dst + i), bgrx);
+    }
+    _wtk_convert_rgba8(dst + i, s, n - i);
+}
+
+static uint8x8_t _wtk_unorm8_neon(float32x4_t lo, float32x4_t hi) {
+    // The nm variants return the number when the other operand is NaN, which clamps it to 0
+    lo = vminnmq_f32(vmaxnmq_f32(lo, vdupq_n_f32(0.0f)), vdupq_n_f32(1.0f));
+    hi = vminnmq_f32(vmaxnmq_f32(hi, vdupq_n_f32(0.0f)), vdupq_n_f32(1.0f));
+    uint32x4_t a = vcvtq_u32_f32(vmlaq_n_f32(vdupq_n_f32(0.5f), lo, 255.0f));
+    uint32x4_t b = vcvtq_u32_f32(vmlaq_n_f32(vdupq_n_f32(0.5f), hi, 255.0f));
+    return vmovn_u16(vcombine_u16(vmovn_u32(a), vmovn_u32(b)));
+}
+
+static void _wtk_convert_rgba32f_neon(uint32_t *dst, void const *src, int n) {
+    float const *s = src;
+    int i = 0;
+    for (; i + 8 <= n; i += 8, s += 32) {
+        float32x4x4_t lo = vld4q_f32(s), hi = vld4q_f32(s + 16);
+        uint8x8x4_t bgrx = {{
+            _wtk_unorm8_neon(lo.val[2], hi.val[2]),
+            _wtk_unorm8_neon(lo.val[1], hi.val[1]),
+            _wtk_unorm8_neon(lo.val[0], hi.val[0]),
+            vdup_n_u8(0xff),
+        }};
+        vst4_u8((uint8_t *)(dst + i), bgrx);
+    }
+    _wtk_convert_rgba32f(dst + i, s, n - i);
+}
+#endif
+
+static _WtkConvertProc *_wtk_convert_procs[WTK_PIXELFORMAT_COUNT];
+
+static void _wtk_select_convert_procs(void) {
+    _wtk_convert_procs[WTK_PIXELFORMAT_BGRX8]   = _wtk_convert_bgrx8;
+    _wtk_convert_procs[WTK_PIXELFORMAT_RGBA8]   = _wtk_convert_rgba8;
+    _wtk_convert_procs[WTK_PIXELFORMAT_RGBA32F] = _wtk_convert_rgba32f;
+#if defined(_WTK_SSE2)
+    _wtk_convert_procs[WTK_PIXELFORMAT_RGBA8]   = _wtk_convert_rgba8_sse2;
+    _wtk_convert_procs[WTK_PIXELFORMAT_RGBA32F] = _wtk_convert_rgba32f_sse2;
+#endif
+#if defined(_WTK_AVX2)
+    if (__builtin_cpu_supports("avx2")) {
+        _wtk_convert_procs[WTK_PIXELFORMAT_RGBA8]   = _wtk_convert_rgba8_avx2;
+        _wtk_convert_procs[WTK_PIXELFORMAT_RGBA32F] = _wtk_convert_rgba32f_avx2;
+    }
+#endif
+#if defined(_WTK_NEON)
+    _wtk_convert_procs[WTK_PIXELFORMAT_RGBA8]   = _wtk_convert_rgba8_neon;
+    _wtk_convert_procs[WTK_PIXELFORMAT_RGBA32F] = _wtk_convert_rgba32f_neon;
+#endif
+}
+
+// Converts a rect->w x rect->h image into the window's buffer at rect->x, rect->y, each pixel blown up to scale x scale.
+// Maps the buffer itself, so blit and present can simply alternate. Returns the part of the window that was written,
+// ready to pass to wtk_window_present_pixels
+wtk_rect_t wtk_window_blit(wtk_window_t *window, void const *src, int format, int stride, wtk_rect_t const *rect, int scale) {
+    wtk_rect_t written = {0};
+    if (!window || !src || !rect || format < 0 || format >= WTK_PIXELFORMAT_COUNT || scale < 1)
+        return written;
+
+    // Mapped every time: a present may have flipped to the other segment and a resize changed the size, and
+    // otherwise it's cheap
+    if (!wtk_window_map_pixels(window, NULL))
+        return written;
+
+    if (!_wtk_convert_procs[0])
+        _wtk_select_convert_procs();
+
+    int bpp = format == WTK_PIXELFORMAT_RGBA32F ? 16 : 4;
+    int x0 = rect->x < 0 ? 0 : rect->x, x1 = rect->x + rect->w * scale;
+    int y0 = rect->y < 0 ? 0 : rect->y, y1 = rect->y + rect->h * scale;
+    if (x1 > window->pixels.w) x1 = window->pixels.w;
+    if (y1 > window->pixels.h) y1 = window->pixels.h;
+    if (x0 >= x1 || y0 >= y1)
+        return written;
+
+    // Source columns that land inside the window
+    int sx0 = (x0 - rect->x) / scale, sx1 = (x1 - rect->x + scale - 1) / scale;
+    if (scale > 1 && window->pixels.row_cap < sx1 - sx0) {
+        uint32_t *grown = realloc(window->pixels.row, (size_t)(sx1 - sx0) * 4);
+        if (!grown)
+            return written;
+        window->pixels.row = grown;
+        window->pixels.row_cap = sx1 - sx0;
+    }
+    uint32_t *row = window->pixels.row;
+
+    _WtkConvertProc *convert = _wtk_convert_procs[format];
+    for (int y = y0; y < y1;) {
+        int sy = (y - rect->y) / scale;
+        char const *line = (char const *)src + (size_t)sy * stride + (size_t)sx0 * bpp;
+        uint32_t *dst = (uint32_t *)((char *)window->pixels.data + (size_t)y * window->pixels.stride) + x0;
+
+        if (scale == 1) {
+            convert(dst, line, x1 - x0);
+            y++;
+            continue;
+        }
+
+        convert(row, line, sx1 - sx0);
+        uint32_t *d = dst, *end = dst + (x1 - x0);
+        int sx = 0, k = (x0 - rect->x) % scale;
+#if defined(_WTK_SSE2)
+        // 2x is the HiDPI case, worth doubling four pixels at a time
+        for (; scale == 2 && !k && end - d >= 8; sx += 4, d += 8) {
+            __m128i p = _mm_loadu_si128((__m128i const *)(row + sx));
+            _mm_storeu_si128((__m128i *)d, _mm_unpacklo_epi32(p, p));
+            _mm_storeu_si128((__m128i *)(d + 4), _mm_unpackhi_epi32(p, p));
+        }
+#endif
+        for (; d < end; sx++, k = 0) {
+            if (end - d >= scale - k) {
+                for (; k < scale; k++)
+                    *d++ = row[sx];
+            } else {
+                while (d < end)
+                    *d++ = row[sx];
+            }
+        }
+
+        // The remaining rows of this source row are copies of the first
+        for (int last = rect->y + (sy + 1) * scale; ++y < y1 && y < last;)
+            memcpy((char *)window->pixels.data + (size_t)y * window->pixels.stride + (size_t)x0 * 4, dst, (size_t)(x1 - x0) * 4);
+    }
+
+    return (wtk_rect_t){x0, y0, x1 - x0, y1 - y0};
 }
 
 void wtk_window_delete(wtk_window_t *window) {
     if (!window) return;
 
+    uint64_t start = _wtk_time_ns();
+    if (_wtk_current == window)
+        _wtk_current = NULL;
+
+    _wtk_registry_remove(window);
     _wtk_window_delete(window);
-    free(window);
+    free(window->queue.events);
+    free(window->pixels.row);
+
+    if (window->prev) window->prev->next = window->next;
+    else              _wtk.window_list = window->next;
+    if (window->next) window->next->prev = window->prev;
+
+    _wtk_window_free(window);
+    _wtk.deleted++;
+    _wtk.stats.windows_deleted++;
+    _wtk.stats.delete_ns += _wtk_time_ns() - start;
+}
+
+// Deletes any remaining windows and closes the native connection. The next wtk_window_create starts over
+void wtk_shutdown(void) {
+    if (!_wtk.initialized) return;
+
+    while (_wtk.window_list)
+        wtk_window_delete(_wtk.window_list);
+
+    wtk_record_end();
+    _wtk_replay_end();
+    _wtk.next_window_id = 0;
+    _wtk_quit();
+    _wtk_registry_clear();
+    _wtk.monitors.valid = 0;
+    _wtk.monitors.changed = 0;
+    _wtk.initialized = 0;
+}
+
+int wtk_window_next_events(wtk_window_t *window, wtk_event_t *events, int cap) {
+    if (!window || !events || cap <= 0 || !window->queue.events)
+        return 0;
 
-    wtk_window_t **prev = &_wtk.window_list;
-    while (*prev != window)
-        prev = &((*prev)->next);
-    *prev = window->next;
+    int n = 0;
+    while (n < cap && window->queue.tail != window->queue.head)
+        events[n++] = window->queue.events[window->queue.tail++ & window->queue.mask];
 
-    if (!_wtk.window_list)
-        _wtk_quit();
+    return n;
 }
 
 void wtk_window_pos(wtk_window_t const *window, int *x, int *y) {
@@ -961,6 +5550,56 @@ int wtk_window_closed(wtk_window_t const *window) {
     return window ? window->closed : 1;
 }
 
+// Reports WINDOWEXPOSE for rect, or the whole window when it is NULL, at the end of the next poll. Until then
+// wtk_wait_events returns without blocking, so an on-demand loop can wait unconditionally. Only call it from the
+// thread that polls; another thread has to hand the request over itself and wake the poller with wtk_post_empty_event
+void wtk_window_request_redraw(wtk_window_t *window, wtk_rect_t const *rect) {
+    if (!window) return;
+    _wtk_window_damage(window, rect ? *rect : (wtk_rect_t){0, 0, window->desc.w, window->desc.h});
+}
+
+// Fills in up to cap monitors, the primary first, and returns how many there are
+int wtk_monitors(wtk_monitor_t *monitors, int cap) {
+    if (!_wtk_lazy_init())
+        return 0;
+
+    _wtk_monitors_update();
+    for (int i = 0; monitors && i < cap && i < _wtk.monitors.count; i++)
+        monitors[i] = _wtk.monitors.list[i];
+    return _wtk.monitors.count;
+}
+
+// The monitor showing most of the window, or the primary when the backend can't tell
+int wtk_window_monitor(wtk_window_t const *window, wtk_monitor_t *monitor) {
+    if (!window || !monitor) return 0;
+
+    _wtk_monitors_update();
+    if (!_wtk.monitors.count)
+        return 0;
+
+    uintptr_t id = _wtk_window_monitor(window);
+    *monitor = _wtk.monitors.list[0];
+    for (int i = 0; i < _wtk.monitors.count; i++)
+        if (_wtk.monitors.list[i].id == id)
+            *monitor = _wtk.monitors.list[i];
+    return 1;
+}
+
+// Valid until the window is deleted. Pair with WTK_CONTEXT_NONE, a surface can't be shared with GL
+wtk_native_t wtk_window_native(wtk_window_t const *window) {
+    return window ? _wtk_window_native(window) : (wtk_native_t){0};
+}
+
+int wtk_key_down(wtk_window_t const *window, int key) {
+    if (!window || key < 0 || key >= 256) return 0;
+    return (window->input.keys[key >> 5] >> (key & 31)) & 1;
+}
+
+int wtk_button_down(wtk_window_t const *window, int button) {
+    if (!window || button < 0 || button >= 32) return 0;
+    return (window->input.buttons >> button) & 1;
+}
+
 void wtk_window_set_pos(wtk_window_t *window, int x, int y) {
     if (!window || x < 0 || y < 0) return;
 